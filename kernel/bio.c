@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,29 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Each of the NBUCKET hash buckets has its own lock, which
+// covers its list and the refcnt of the bufs on it, so
+// processes using different blocks don't contend. A miss
+// recycles the unused buf that was released longest ago,
+// from whichever bucket it is in; bcache.lock serializes
+// misses, so that two can't take the same buf or both add
+// the same block.
+//
+// The cache is sized from memory: a miss adds bufs while
+// there are fewer than 1/BCACHEFRAC of the pages kinit() found
+// and memory to spare, BPP bufs to a page from kalloc(), and
+// when kalloc() runs out, bshrink() gives back pages whose
+// bufs are all unused, down to NBUF bufs, or as many as the
+// log asked for with bsetmin(), and pages of buf headers
+// once none of their groups is in the cache.
+//
+// breadahead() starts reading blocks that aren't cached and
+// returns at once, leaving each buf locked and referenced until
+// the disk is done and bdone() lets go of it, so that a bread()
+// of the block in the meantime waits for the read to finish.
+// It and bwritestart() ask the disk for each run of consecutive
+// blocks in one request.
 
 
 #include "types.h"
@@ -22,70 +45,286 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;  // circular list through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+#define BPP (PGSIZE / BSIZE)  // bufs whose data share a page
+#define BFREEMIN 512          // free pages below which the cache stops growing
+
+// BPP bufs and the page that holds their data. Groups come
+// GPP to a page of their own from kalloc().
+struct bgroup {
+  struct buf buf[BPP];
+  struct bgroup *next;  // on bcache.groups or bcache.spare
+};
+
+#define GPP (PGSIZE / sizeof(struct bgroup))
+#define GPAGE(g) PGROUNDDOWN((uint64)(g))
+
+struct {
+  struct spinlock lock;  // held by a miss, bgrow() and bshrink(), before bucket locks
+  struct bucket bucket[NBUCKET];
+  struct bgroup *groups; // groups in the cache
+  struct bgroup *spare;  // groups without a data page
+  int nbuf;              // bufs in the cache
+  int minbuf;            // fewest bufs bshrink() leaves
+  int maxbuf;            // most bufs the cache may grow to
+  uint64 hits;
+  uint64 misses;
+  uint64 aheads;         // blocks breadahead() read
 } bcache;
 
+static struct bucket*
+bucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Find the buf for dev and blockno in bk, or return 0.
+// Caller holds bk->lock.
+static struct buf*
+lookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Add b to the front of bk's list. Caller holds bk->lock.
+static void
+bucketadd(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Give back the page that spare group g is in, if all the
+// groups in it are spare. Caller holds bcache.lock.
+static void
+bfreegroups(struct bgroup *g)
+{
+  struct bgroup *s, **pp;
+  uint64 page = GPAGE(g);
+  int n = 0;
+
+  for(s = bcache.spare; s != 0; s = s->next)
+    if(GPAGE(s) == page)
+      n++;
+  if(n < GPP)
+    return;
+  for(pp = &bcache.spare; (s = *pp) != 0; ){
+    if(GPAGE(s) == page)
+      *pp = s->next;
+    else
+      pp = &s->next;
+  }
+  kfree((void*)page);
+}
+
+// Add a group of bufs to the cache, with data page data and,
+// if there are no spare groups, hdr for more. Caller holds
+// bcache.lock. Returns 0, or -1 if the pages weren't needed.
+static int
+baddgroup(char *data, char *hdr)
+{
+  struct bgroup *g;
+  struct bucket *bk;
+  struct buf *b;
+
+  if(hdr){
+    for(g = (struct bgroup*)hdr; g + 1 <= (struct bgroup*)(hdr + PGSIZE); g++){
+      for(b = g->buf; b < &g->buf[BPP]; b++)
+        initsleeplock(&b->lock, "buffer");
+      g->next = bcache.spare;
+      bcache.spare = g;
+    }
+  }
+  if(bcache.spare == 0 || bcache.nbuf + BPP > bcache.maxbuf){
+    if(hdr)
+      bfreegroups((struct bgroup*)hdr);
+    return -1;
+  }
+
+  g = bcache.spare;
+  bcache.spare = g->next;
+  g->next = bcache.groups;
+  bcache.groups = g;
+
+  // every buf starts out as block 0 of device 0, unused
+  // since the beginning of time.
+  bk = bucket(0, 0);
+  acquire(&bk->lock);
+  for(int i = 0; i < BPP; i++){
+    b = &g->buf[i];
+    b->data = (uchar*)data + i*BSIZE;
+    b->dev = 0;
+    b->blockno = 0;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->lastuse = 0;
+    b->logseq = 0;
+    bucketadd(bk, b);
+  }
+  release(&bk->lock);
+  bcache.nbuf += BPP;
+  return 0;
+}
+
+// Grow the cache by a group, if it may grow and memory is
+// plentiful. Called without locks, since kalloc() may call
+// bshrink().
+static void
+bgrow(void)
+{
+  char *data, *hdr = 0;
+
+  if(bcache.nbuf + BPP > bcache.maxbuf || kfreepages() < BFREEMIN)
+    return;
+  if((data = kalloc()) == 0)
+    return;
+  if(bcache.spare == 0 && (hdr = kalloc()) == 0){
+    kfree(data);
+    return;
+  }
+  acquire(&bcache.lock);
+  if(baddgroup(data, hdr) < 0)
+    kfree(data);
+  release(&bcache.lock);
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  bcache.maxbuf = kfreepages() / BCACHEFRAC * BPP;
+  bsetmin(NBUF);
+}
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Keep at least n bufs in the cache, growing it now if it
+// is smaller. Called without locks, since kalloc() may
+// call bshrink().
+void
+bsetmin(int n)
+{
+  char *data, *hdr;
+
+  n = (n + BPP - 1) / BPP * BPP;
+  bcache.minbuf = n;
+  if(bcache.maxbuf < n)
+    bcache.maxbuf = n;
+  while(bcache.nbuf < n){
+    hdr = 0;
+    if((data = kalloc()) == 0 || (bcache.spare == 0 && (hdr = kalloc()) == 0))
+      panic("bsetmin");
+    acquire(&bcache.lock);
+    if(baddgroup(data, hdr) < 0)
+      panic("bsetmin");
+    release(&bcache.lock);
   }
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
+// In either case, return locked buffer; but if ahead is
+// set, return 0 if the block is cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct bucket *bk = bucket(dev, blockno), *k, *vk = 0;
+  struct buf *b, *victim = 0;
+  int found;
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bk->lock);
+  if((b = lookup(bk, dev, blockno)) != 0){
+    if(ahead){
+      release(&bk->lock);
+      return 0;
     }
+    b->refcnt++;
+    release(&bk->lock);
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Not cached. Make room for it if the cache can grow.
+  bgrow();
+
+  // Look again now that no other miss can add it, then
+  // recycle the least recently used unused buffer, keeping
+  // the lock of the bucket that holds the best so far.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = lookup(bk, dev, blockno)) != 0){
+    if(ahead){
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
+    }
+    b->refcnt++;
+    __sync_fetch_and_add(&bcache.hits, 1);
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  for(k = bcache.bucket; k < &bcache.bucket[NBUCKET]; k++){
+    acquire(&k->lock);
+    found = 0;
+    for(b = k->head.next; b != &k->head; b = b->next){
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        found = 1;
+      }
+    }
+    if(found){
+      if(vk)
+        release(&vk->lock);
+      vk = k;
+    } else {
+      release(&k->lock);
     }
   }
-  panic("bget: no buffers");
+  if(victim == 0)
+    panic("bget: no buffers");
+  __sync_fetch_and_add(&bcache.misses, 1);
+
+  victim->next->prev = victim->prev;
+  victim->prev->next = victim->next;
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  if(vk != bk){
+    release(&vk->lock);
+    acquire(&bk->lock);
+  }
+  bucketadd(bk, victim);
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +333,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +341,69 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Drop a reference to b, noting when it was last used, for
+// bget() to recycle the least recently used buffer.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+  }
+  release(&bk->lock);
+}
+
+// The disk has read b for breadahead(). Called by
+// virtio_disk_intr(), in interrupt context.
+static void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Start disk requests for the n locked bufs at b, one for
+// each run of up to MAXSEGS consecutive blocks.
+static void
+bstart(struct buf **b, int n, int write, void (*done)(struct buf *))
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < MAXSEGS; j++)
+      if(b[j]->dev != b[i]->dev || b[j]->blockno != b[j-1]->blockno + 1)
+        break;
+    virtio_disk_start(b + i, j - i, write, done);
+  }
+}
+
+// Start reading the n blocks at blockno into the cache,
+// skipping those that are there already, without waiting
+// for the disk.
+void
+breadahead(uint dev, uint *blockno, int n)
+{
+  struct buf *b[MAXSEGS];
+  int nb = 0;
+
+  for(int i = 0; i < n; i++){
+    if((b[nb] = bget(dev, blockno[i], 1)) == 0)
+      continue;
+    __sync_fetch_and_add(&bcache.aheads, 1);
+    if(++nb == MAXSEGS){
+      bstart(b, nb, 0, bdone);
+      nb = 0;
+    }
+  }
+  if(nb > 0)
+    bstart(b, nb, 0, bdone);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +413,37 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing the contents of the n bufs at b to disk, and
+// return without waiting. Sorts b by block number, to find
+// runs of consecutive blocks. Each buf must stay locked until
+// bwait() on it.
+void
+bwritestart(struct buf **b, int n)
+{
+  struct buf *t;
+  int i, j;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritestart");
+    t = b[i];
+    for(j = i; j > 0 && b[j-1]->blockno > t->blockno; j--)
+      b[j] = b[j-1];
+    b[j] = t;
+  }
+  bstart(b, n, 1, 0);
+}
+
+// Wait for the write bwritestart() began.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +451,96 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
+  release(&bk->lock);
+}
+
+// Out of memory: give back up to n pages of cached blocks
+// that no one is using, keeping at least bcache.minbuf bufs.
+// Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct bgroup *g, **pp;
+  struct bucket *bk;
+  struct buf *b;
+  int i, freed = 0;
+
+  acquire(&bcache.lock);
+  pp = &bcache.groups;
+  while((g = *pp) != 0 && freed < n && bcache.nbuf - BPP >= bcache.minbuf){
+    // take the group's bufs out of their buckets, unless
+    // one is in use. misses wait for bcache.lock, and will
+    // find any buf that has to go back.
+    for(i = 0; i < BPP; i++){
+      b = &g->buf[i];
+      bk = bucket(b->dev, b->blockno);
+      acquire(&bk->lock);
+      if(b->refcnt != 0){
+        release(&bk->lock);
+        break;
+      }
+      b->next->prev = b->prev;
+      b->prev->next = b->next;
+      release(&bk->lock);
+    }
+    if(i < BPP){
+      while(--i >= 0){
+        b = &g->buf[i];
+        bk = bucket(b->dev, b->blockno);
+        acquire(&bk->lock);
+        bucketadd(bk, b);
+        release(&bk->lock);
+      }
+      pp = &g->next;
+      continue;
+    }
+    *pp = g->next;
+    g->next = bcache.spare;
+    bcache.spare = g;
+    kfree(g->buf[0].data);
+    bfreegroups(g);
+    bcache.nbuf -= BPP;
+    freed++;
+  }
   release(&bcache.lock);
+  return freed;
 }
 
+// Fill in the buffer cache part of *ms. Doesn't take the
+// locks; the counts needn't be exact.
+void
+bstat(struct memstat *ms)
+{
+  struct bucket *bk;
 
+  ms->bufs = bcache.nbuf;
+  ms->bufmax = bcache.maxbuf;
+  ms->bufhits = bcache.hits;
+  ms->bufmisses = bcache.misses;
+  ms->bufaheads = bcache.aheads;
+
+  ms->bufacquires = bcache.lock.nacquire;
+  ms->bufwaits = bcache.lock.nwait;
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++){
+    ms->bufacquires += bk->lock.nacquire;
+    ms->bufwaits += bk->lock.nwait;
+  }
+}
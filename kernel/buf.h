@@ -5,8 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when refcnt last fell to 0
+  uint64 logseq;    // transaction that log_write() last took it into
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, in a page shared with other bufs
 };
 
@@ -80,7 +80,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -108,8 +108,13 @@ consoleread(int user_dst, uint64 dst, int n)
     }
 
     // copy the input byte to the user-space buffer.
+    // not holding cons.lock, since either_copyout()
+    // may have to page in.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    r = either_copyout(user_dst, dst, &cbuf, 1);
+    acquire(&cons.lock);
+    if(r == -1)
       break;
 
     dst++;
@@ -2,12 +2,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct spawnact;
 struct superblock;
+struct vma;
 
 /* Added for Task 1 - Peterson Lock Function Declarations */
 // peterson.c
@@ -22,9 +25,15 @@ int             peterson_destroy_impl(int);
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            breadahead(uint, uint*, int);
+void            bsetmin(int);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf**, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bstat(struct memstat*);
+int             bshrink(int);
 
 // console.c
 void            consoleinit(void);
@@ -40,6 +49,8 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             fileseek(struct file*, int, int);
+int             filesplice(struct file*, struct file*, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
@@ -49,6 +60,9 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            itextdup(struct inode*);
+void            itextput(struct inode*);
+int             itextbusy(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -70,20 +84,45 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
+int             kzeroidle(void);
+void            kdup(void *);
+int             krefs(void *);
+int             krefspeek(void *);
 void            kinit(void);
+void*           megaalloc(void);
+void            megafree(void *);
+void            kmemstat(struct memstat*);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_writemax(void);
+int             log_writeres(int);
+void            log_sync(void);
+void            logstat(struct memstat*);
+
+// pcache.c
+void            pcacheinit(void);
+void*           pcacheget(struct inode*, uint, uint);
+void            pcacheput(struct inode*, uint, uint, void*);
+void            pcacheinval(struct inode*);
+int             pcachereclaim(void);
+int             pcachecount(void);
+void            pcachedump(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesplice(struct pipe*, struct file*, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -98,6 +137,13 @@ int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+void            asidinit(void);
+uint64          proc_satp(struct proc *, int *);
+void            proc_flushtlb(struct proc *);
+int             procmem(uint64, int);
+int             spawn(char*, char**, struct spawnact*, int);
+void            spawnret(void);
+void            kthread(void (*)(void), char*);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -142,6 +188,14 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(struct superblock*);
+int             swapout(int);
+int             swapin(pte_t*);
+void            swapdup(pte_t);
+void            swapput(pte_t);
+void            swapstat(struct memstat*);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -150,6 +204,9 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+int             spawnfiles(struct spawnact*, int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -176,13 +233,29 @@ uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmdiscard(pagetable_t, uint64, uint64);
+int             uvmexchange(pagetable_t, uint64, char**);
 void            uvmclear(pagetable_t, uint64);
+uint64          uvmresident(pagetable_t, uint64*);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// vma.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             madvise(uint64, uint64, int);
+void            vmaclear(void);
+void            vmasetsegs(struct vma*, int);
+void            vmaputsegs(struct vma*, int);
+int             vmacopy(struct proc*, struct proc*);
+uint64          vmabase(struct proc*);
+int             vmafault(pagetable_t, uint64, int);
+void            vmafaultin(uint64, uint64, int);
+int             vmashared(struct proc*, uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -192,6 +265,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void*, int);
+void            virtio_disk_start(struct buf **, int, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_stat(struct memstat*);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -6,9 +6,13 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fcntl.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
+// segments beyond the first NSEG are loaded eagerly.
+#define NSEG 4
+
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -19,6 +23,16 @@ int flags2perm(int flags)
     return perm;
 }
 
+int flags2prot(int flags)
+{
+    int prot = PROT_READ;
+    if(flags & 0x1)
+      prot |= PROT_EXEC;
+    if(flags & 0x2)
+      prot |= PROT_WRITE;
+    return prot;
+}
+
 int
 exec(char *path, char **argv)
 {
@@ -30,6 +44,8 @@ exec(char *path, char **argv)
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct vma seg[NSEG];
+  int nseg = 0;
 
   begin_op();
 
@@ -61,6 +77,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(PGROUNDUP(ph.vaddr + ph.memsz) + 2*PGSIZE > TRAPFRAME)
+      goto bad;
+    if(ph.vaddr >= sz && nseg < NSEG){
+      // don't read the segment now; vmafault() will
+      // page it in as the program touches it.
+      struct vma *v = &seg[nseg++];
+      memset(v, 0, sizeof(*v));
+      v->addr = ph.vaddr;
+      v->len = PGROUNDUP(ph.vaddr + ph.memsz) - ph.vaddr;
+      v->prot = flags2prot(ph.flags);
+      v->flags = MAP_PRIVATE | VMA_SEG;
+      v->ip = idup(ip);
+      itextdup(ip);
+      v->off = ph.off;
+      v->filesz = ph.filesz;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -121,8 +155,16 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaclear();
+  vmasetsegs(seg, nseg);
+  // procmem() walks p->pagetable holding p->lock, so the
+  // old one can be freed once it has been swapped out
+  // under the lock.
+  acquire(&p->lock);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  release(&p->lock);
+  proc_flushtlb(p);
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
@@ -137,6 +179,7 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmaputsegs(seg, nseg);
   return -1;
 }
 
@@ -3,3 +3,24 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_EXTENT  0x800  // an empty file gets the extent layout
+
+// lseek() whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+// mmap() protection
+#define PROT_NONE   0x0
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+// mmap() flags
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANON    0x20
+
+// madvise() advice
+#define MADV_NORMAL   0
+#define MADV_DONTNEED 4
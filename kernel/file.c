@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -118,6 +119,10 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    // page in mmap()ed destination pages now; readi()
+    // copies out while holding a buffer.
+    if(n > 0)
+      vmafaultin(addr, n, PROT_WRITE);
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
@@ -129,6 +134,47 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Set the offset of file f to off, counted from whence
+// (SEEK_SET, SEEK_CUR or SEEK_END). The offset may go past
+// the end of the file, where reads return 0.
+// Returns the new offset, or -1.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base, r = -1;
+
+  if(f->type != FD_INODE)
+    return -1;
+
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else
+    base = -1;
+  if(base >= 0 && base + off >= 0)
+    r = f->off = base + off;
+  iunlock(f->ip);
+  return r;
+}
+
+// Move up to n bytes from fin to fout, one of them a pipe
+// and the other a file, for splice().
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+  if(fin->type == FD_INODE && fout->type == FD_PIPE)
+    return pipesplice(fout->pipe, fin, n, 0);
+  if(fin->type == FD_PIPE && fout->type == FD_INODE)
+    return pipesplice(fin->pipe, fout, n, 1);
+  return -1;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -146,25 +192,26 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as much at a time as one FS system call may,
+    // reserving room in the log for what writei() may
+    // touch; see log_writeres().
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = log_writemax();
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int res = log_writeres(n1);
 
-      begin_op();
+      vmafaultin(addr + i, n1, PROT_READ);
+      begin_opn(res);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(res);
 
       if(r != n1){
         // error from writei
@@ -26,7 +26,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uint addrs[NDIRECT+NLEVEL];
+
+  int pcached;        // may have pages in the page cache
+  int ntext;          // program segments that page in from it; under itable.lock
+  uint raoff;         // offset where the last readi() ended
+  uint rawin;         // blocks to read ahead; 0 if reads aren't sequential
+  uint ranext;        // first block not read ahead yet
+  uint bmapblock;     // last bottom-level index block bmap() used, or 0
+  uint bmapfirst;     // first block of the file it maps
 };
 
 // map major device number to device functions.
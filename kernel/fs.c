@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(&sb);
 }
 
 // Zero a block.
@@ -87,6 +88,67 @@ balloc(uint dev)
   return 0;
 }
 
+// Take block b, zeroed, if it's free.
+// Returns b, or 0 if it's in use.
+static uint
+btake(uint dev, uint b)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;
+  log_write(bp);
+  brelse(bp);
+  bzero(dev, b);
+  return b;
+}
+
+// Allocate a zeroed disk block for an I_EXTENT file whose
+// last extent ends at goal, 0 if it has none: goal itself,
+// so that the extent grows, if it's free; else the middle
+// of the first run of EXTRUN free blocks after goal; else
+// any free block.
+// returns 0 if out of disk space.
+static uint
+ballocrun(uint dev, uint goal)
+{
+  struct buf *bp;
+  uint b, n, run;
+
+  if(goal > 0 && goal < sb.size && btake(dev, goal))
+    return goal;
+
+  bp = 0;
+  run = 0;
+  for(n = 0; n < sb.size; n++){
+    b = (goal + n) % sb.size;
+    if(bp == 0 || b % BPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    if(b == 0 || (bp->data[b % BPB / 8] & (1 << (b % 8)))){
+      run = 0;
+    } else if(++run == EXTRUN){
+      brelse(bp);
+      bp = 0;
+      run = 0;
+      if(btake(dev, b - EXTRUN/2 + 1))
+        return b - EXTRUN/2 + 1;
+    }
+  }
+  if(bp)
+    brelse(bp);
+  return balloc(dev);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -235,6 +297,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -271,6 +334,12 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->pcached = 1;  // until pcacheinval() says otherwise
+  ip->raoff = 0;
+  ip->rawin = 0;
+  ip->ranext = 0;
+  ip->bmapblock = 0;
+  ip->ntext = 0;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +356,39 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count a program segment that pages in from ip, which
+// must not change while any does, or uncount one. exec()
+// maps a program while holding ip->lock, so a writer
+// holding it that finds itextbusy() false is safe.
+void
+itextdup(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->ntext++;
+  release(&itable.lock);
+}
+
+void
+itextput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  if(ip->ntext < 1)
+    panic("itextput");
+  ip->ntext--;
+  release(&itable.lock);
+}
+
+int
+itextbusy(struct inode *ip)
+{
+  int busy;
+
+  acquire(&itable.lock);
+  busy = ip->ntext > 0;
+  release(&itable.lock);
+  return busy;
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -308,6 +410,7 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -374,7 +477,100 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// them in the blocks listed in block ip->addrs[NDIRECT+1],
+// and the NTINDIRECT after those one level further down,
+// from ip->addrs[NDIRECT+2].
+//
+// bmap() remembers the last bottom-level index block it
+// used, so that a run of lookups in the blocks it lists
+// reads just that block, not the whole path down to it.
+//
+// An I_EXTENT file lists runs of blocks instead, as extents
+// (see fs.h). Since files have no holes, new blocks go at
+// the end: onto the end of the last extent if the next block
+// on disk is free, which ballocrun() tries to arrange, or
+// else into a new extent.
+
+// Return the disk block address of the nth block of
+// I_EXTENT inode ip, allocating it if n is just past the
+// last block. Returns 0 if out of disk space or extents.
+static uint
+emap(struct inode *ip, uint bn)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint first, addr;
+  int i;
+
+  bp = 0;
+  last = 0;
+  first = 0;
+  for(i = 0; i < NEXTENT + NXEXTENT; i++){
+    if(i == NEXTENT){
+      if(XBLOCK(ip->addrs) == 0)
+        break;
+      bp = bread(ip->dev, XBLOCK(ip->addrs));
+    }
+    if(i < NEXTENT)
+      e = (struct extent*)ip->addrs + i;
+    else
+      e = (struct extent*)bp->data + (i - NEXTENT);
+    if(e->len == 0)
+      break;
+    if(bn - first < e->len){
+      addr = e->start + (bn - first);
+      if(bp)
+        brelse(bp);
+      return addr;
+    }
+    first += e->len;
+    last = e;
+  }
+  if(bn != first)
+    panic("emap: hole");
+
+  addr = ballocrun(ip->dev, last ? last->start + last->len : 0);
+  if(addr && last && addr == last->start + last->len){
+    last->len++;
+    if(i > NEXTENT)
+      log_write(bp);
+  } else if(addr){
+    if(i == NEXTENT + NXEXTENT){
+      bfree(ip->dev, addr);
+      addr = 0;
+    } else if(i == NEXTENT && XBLOCK(ip->addrs) == 0 &&
+              (XBLOCK(ip->addrs) = balloc(ip->dev)) == 0){
+      bfree(ip->dev, addr);
+      addr = 0;
+    } else {
+      if(i >= NEXTENT && bp == 0)
+        bp = bread(ip->dev, XBLOCK(ip->addrs));
+      if(i < NEXTENT)
+        e = (struct extent*)ip->addrs + i;
+      else
+        e = (struct extent*)bp->data + (i - NEXTENT);
+      e->start = addr;
+      e->len = 1;
+      if(bp)
+        log_write(bp);
+    }
+  }
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Return the address in *p, allocating a block for it if
+// it's 0. If p points into index block bp, log the change.
+// Returns 0 if out of disk space.
+static uint
+bmapget(struct inode *ip, uint *p, struct buf *bp)
+{
+  if(*p == 0 && (*p = balloc(ip->dev)) != 0 && bp)
+    log_write(bp);
+  return *p;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,42 +578,83 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, first, n;
   struct buf *bp;
+  int level;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
-    }
+  if(ip->flags & I_EXTENT)
+    return emap(ip, bn);
+  if(bn < NDIRECT)
+    return bmapget(ip, &ip->addrs[bn], 0);
+
+  if(ip->bmapblock && bn >= ip->bmapfirst && bn - ip->bmapfirst < NINDIRECT){
+    bp = bread(ip->dev, ip->bmapblock);
+    addr = bmapget(ip, (uint*)bp->data + (bn - ip->bmapfirst), bp);
+    brelse(bp);
     return addr;
   }
-  bn -= NDIRECT;
-
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
+
+  // find the tree bn is in: level levels of index blocks
+  // over n blocks, starting with block first.
+  first = NDIRECT;
+  n = NINDIRECT;
+  for(level = 1; bn - first >= n; level++){
+    if(level == NLEVEL)
+      panic("bmap: out of range");
+    first += n;
+    n *= NINDIRECT;
+  }
+
+  // walk down it, allocating index blocks as needed.
+  if((addr = bmapget(ip, &ip->addrs[NDIRECT + level - 1], 0)) == 0)
+    return 0;
+  while(level-- > 0){
+    n /= NINDIRECT;
+    if(level == 0){
+      ip->bmapblock = addr;
+      ip->bmapfirst = first;
     }
+    bp = bread(ip->dev, addr);
+    addr = bmapget(ip, (uint*)bp->data + (bn - first) / n, bp);
+    brelse(bp);
+    if(addr == 0)
+      return 0;
+    first += (bn - first) / n * n;
+  }
+  return addr;
+}
+
+// Free block addr, which is an index block with levels
+// of index blocks below it if levels > 0, and the blocks
+// it lists.
+static void
+bmapfree(struct inode *ip, uint addr, int levels)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  if(levels > 0){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bmapfree(ip, a[j], levels - 1);
     }
     brelse(bp);
-    return addr;
   }
+  bfree(ip->dev, addr);
+}
+
+// Free the blocks of the first n extents in e[].
+static void
+efree(struct inode *ip, struct extent *e, int n)
+{
+  uint b;
 
-  panic("bmap: out of range");
+  for(; n > 0 && e->len > 0; n--, e++)
+    for(b = e->start; b < e->start + e->len; b++)
+      bfree(ip->dev, b);
 }
 
 // Truncate inode (discard contents).
@@ -425,28 +662,29 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
   struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  if(ip->pcached)
+    pcacheinval(ip);
+
+  if(ip->flags & I_EXTENT){
+    if(XBLOCK(ip->addrs)){
+      bp = bread(ip->dev, XBLOCK(ip->addrs));
+      efree(ip, (struct extent*)bp->data, NXEXTENT);
+      brelse(bp);
+      bfree(ip->dev, XBLOCK(ip->addrs));
     }
+    efree(ip, (struct extent*)ip->addrs, NEXTENT);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NDIRECT + NLEVEL; i++){
+    if(ip->addrs[i]){
+      bmapfree(ip, ip->addrs[i], i < NDIRECT ? 0 : i - NDIRECT + 1);
+      ip->addrs[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->bmapblock = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -464,6 +702,62 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// A read of n bytes at off is about to start: start reading
+// its blocks into the buffer cache all at once, rather than
+// one after another as readi() copies them, so that the disk
+// gets runs of consecutive blocks in single requests. If it carries on
+// where the last read ended, read ahead of it as well, so
+// that the disk works while the reader copies. Each
+// sequential read doubles the window of blocks read ahead,
+// up to RAMAX; any other read closes it. The window is
+// refilled in one batch once the reader gets within half a
+// window of its end, not a block or two at every read, so
+// that the disk keeps getting long runs. Only for files:
+// directories are read in small pieces, all over the place.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, addr, blocks[MAXSEGS];
+  int n1 = 0, seq;
+
+  if(n == 0 || ip->type != T_FILE)
+    return;
+  bn = off / BSIZE;
+  end = (off + n + BSIZE - 1) / BSIZE;
+  seq = off == ip->raoff;
+  if(!seq && end - bn <= 1){
+    // nothing to batch: let readi() bread() the block.
+    ip->rawin = 0;
+    ip->raoff = off + n;
+    ip->ranext = end;
+    return;
+  }
+  if(seq){
+    ip->rawin = ip->rawin == 0 ? RAMAX/8 : min(2*ip->rawin, RAMAX);
+    if(ip->ranext < end + ip->rawin/2)
+      end = min(end + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+    if(ip->ranext > bn)
+      bn = min(ip->ranext, end);  // earlier reads started these
+  } else {
+    ip->rawin = 0;
+  }
+  ip->raoff = off + n;
+
+  for(; bn < end; bn++){
+    if((addr = bmap(ip, bn)) == 0)
+      break;
+    blocks[n1++] = addr;
+    if(n1 == MAXSEGS){
+      breadahead(ip->dev, blocks, n1);
+      n1 = 0;
+    }
+  }
+  breadahead(ip->dev, blocks, n1);
+  if(!seq || bn > ip->ranext)
+    ip->ranext = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -478,6 +772,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -512,6 +807,13 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(itextbusy(ip))
+    return -1;  // a running program pages in from it
+
+  // cached pages of the old contents must not be
+  // handed out again.
+  if(ip->pcached)
+    pcacheinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
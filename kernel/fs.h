@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                             free bit map | data blocks | swap area ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +20,22 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of the swap area, after the file system
+  uint nswap;        // Number of page-sized slots in the swap area
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// most blocks the log header can name, and so most blocks
+// in the log, besides the header.
+#define LOGMAX (BSIZE / sizeof(int) - 2)
+
+#define NDIRECT 9
+#define NLEVEL 3  // levels of index blocks: single, double and triple indirect
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +44,30 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_EXTENT
+  uint addrs[NDIRECT+NLEVEL];   // Data block addresses
+};
+
+// dinode flags
+#define I_EXTENT 0x1  // addrs[] lists extents, not blocks
+
+// An I_EXTENT file's blocks are runs of consecutive blocks,
+// extents: NEXTENT of them in addrs[], and NXEXTENT more in
+// the block whose address is in the last of addrs[].
+struct extent {
+  uint start;           // first block of the run
+  uint len;             // number of blocks, 0 if the extent is unused
 };
 
+#define NEXTENT ((NDIRECT+NLEVEL-1) / 2)
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+#define XBLOCK(addrs) ((addrs)[NDIRECT+NLEVEL-1])
+
+// a new extent starts half-way into a run of EXTRUN free
+// blocks, if there is one, so that it has room to grow, and
+// so does an extent that may end just before the run.
+#define EXTRUN 64
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
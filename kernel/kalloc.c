@@ -1,15 +1,33 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+// NHUGEPG 2MB megapages at the top of RAM are kept
+// apart for large user heaps; see megaalloc(). Build with
+// NHUGEPG=n to have some; there are none by default.
+// A page may be shared, e.g. read-only text mapped by
+// several processes and the page cache; kdup() adds a
+// reference and kfree() frees it when the last one goes.
+// Free pages that are already zero sit on their own list,
+// topped up by the scheduler when it has nothing to run;
+// kalloc_zeroed() takes from it first.
+// kmemstat() reports free and shared page counts.
+// When memory runs out, kalloc() takes back unmapped pages
+// from the page cache, then, if the caller can sleep, has
+// swapout() write pages of other processes to disk.
+// Build with KJUNK=1 to fill pages with junk on kalloc()
+// and kfree(), to catch use of uninitialized or freed memory.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
+#include "memstat.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
+static void megaput(void *pa);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
@@ -18,16 +36,40 @@ struct run {
   struct run *next;
 };
 
+// index of physical page pa in kmem.ref[].
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist;               // free pages of any contents
+  struct run *zerolist;               // free pages known to be zero
+  int nzero;                          // length of zerolist
+  int nfree;                          // pages on both lists
+  int npages;                         // pages kinit() freed
+  uint64 nalloc;                      // successful allocations
+  uint64 nfail;                       // failed allocations
+  int ref[(PHYSTOP-KERNBASE)/PGSIZE]; // references to each page in use
 } kmem;
 
+// first byte of the megapage pool.
+#define MEGABASE (PHYSTOP - NHUGEPG*MEGAPGSIZE)
+
+// ref[i] is the number of 4096-byte pieces of megapage i
+// still in use, 0 if the megapage is free. uvmdealloc()
+// may split a megapage into 4096-byte mappings; the pieces
+// then come back one at a time through kfree().
+struct {
+  struct spinlock lock;
+  int ref[NHUGEPG > 0 ? NHUGEPG : 1]; // no zero-length array
+} kmega;
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  initlock(&kmega.lock, "kmega");
+  freerange(end, (void*)MEGABASE);
+  kmem.npages = kmem.nfree;
 }
 
 void
@@ -51,32 +93,294 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((uint64)pa >= MEGABASE){
+    megaput(pa);
+    return;
+  }
+
+  // Drop a reference; only the last one frees the page.
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] > 1){
+    kmem.ref[PA2REF(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  kmem.ref[PA2REF(pa)] = 0;
+  release(&kmem.lock);
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
+  release(&kmem.lock);
+}
+
+// Add a reference to page pa, which kalloc() returned.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= MEGABASE)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("kdup: free page");
+  kmem.ref[PA2REF(pa)]++;
+  release(&kmem.lock);
+}
+
+// Number of references to page pa.
+int
+krefs(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PA2REF(pa)];
+  release(&kmem.lock);
+  return n;
+}
+
+// Number of references to page pa, read without kmem.lock,
+// for ^P dumps, which mustn't wait on a stuck lock. The
+// count may be stale.
+int
+krefspeek(void *pa)
+{
+  return kmem.ref[PA2REF(pa)];
+}
+
+// Take a page off list, or the other list if list is empty.
+// Caller holds kmem.lock.
+static struct run*
+kpop(struct run **list, struct run **other)
+{
+  struct run *r;
+
+  if(*list == 0)
+    list = other;
+  r = *list;
+  if(r){
+    *list = r->next;
+    if(list == &kmem.zerolist)
+      kmem.nzero--;
+    kmem.nfree--;
+    kmem.nalloc++;
+    kmem.ref[PA2REF(r)] = 1;
+  }
+  return r;
+}
+
+// Can the caller sleep? That is, is it a process holding
+// no spinlocks, with interrupts on?
+static int
+cansleep(void)
+{
+  int ok;
+
+  push_off();
+  ok = myproc() != 0 && mycpu()->noff == 1 && mycpu()->intena;
+  pop_off();
+  return ok;
+}
+
+// Out of memory: free some pages for kalloc() to retry.
+// Returns the number freed.
+static int
+kreclaim(void)
+{
+  int n;
+
+  // first give back cached pages no one maps, then
+  // cached disk blocks no one is using.
+  if((n = pcachereclaim()) > 0)
+    return n;
+  if((n = bshrink(SWAPBATCH)) > 0)
+    return n;
+  if(cansleep())
+    return swapout(SWAPBATCH);
+  return 0;
+}
+
+// Count an allocation that found no memory.
+static void
+kfailed(void)
+{
+  acquire(&kmem.lock);
+  kmem.nfail++;
   release(&kmem.lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The contents are undefined; pages that are
+// already zero are saved for kalloc_zeroed().
 void *
 kalloc(void)
 {
   struct run *r;
+  int tries = 0;
 
+ again:
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = kpop(&kmem.freelist, &kmem.zerolist);
   release(&kmem.lock);
 
+  if(r == 0 && tries++ < 3 && kreclaim() > 0)
+    goto again;
+  if(r == 0)
+    kfailed();
+
+#ifdef KJUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one 4096-byte page of zeroed physical memory,
+// from the pool of pre-zeroed pages if it has one.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  int zeroed, tries = 0;
+
+ again:
+  acquire(&kmem.lock);
+  zeroed = kmem.zerolist != 0;
+  r = kpop(&kmem.zerolist, &kmem.freelist);
+  release(&kmem.lock);
+
+  if(r == 0 && tries++ < 3 && kreclaim() > 0)
+    goto again;
+  if(r == 0)
+    kfailed();
+
+  if(r && zeroed)
+    r->next = 0;  // the only word the free list wrote
+  else if(r)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Zero one free page and move it to the zeroed pool, if
+// the pool is short of NZEROPG. Called by an idle scheduler.
+// Returns 1 if it zeroed a page, 0 if there was nothing to do.
+int
+kzeroidle(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = 0;
+  if(kmem.nzero < NZEROPG && kmem.freelist){
+    r = kmem.freelist;
+    kmem.freelist = r->next;
+  }
+  release(&kmem.lock);
+  if(r == 0)
+    return 0;
+
+  // no one else can see the page while it is off both lists.
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Allocate one 2MB megapage from the pool.
+// Returns 0 if none is free. The contents are not cleared.
+void *
+megaalloc(void)
+{
+  void *pa = 0;
+
+  acquire(&kmega.lock);
+  for(int i = 0; i < NHUGEPG; i++){
+    if(kmega.ref[i] == 0){
+      kmega.ref[i] = MEGAPGSIZE / PGSIZE;
+      pa = (void*)(MEGABASE + (uint64)i*MEGAPGSIZE);
+      break;
+    }
+  }
+  release(&kmega.lock);
+  return pa;
+}
+
+// Free a whole megapage returned by megaalloc().
+void
+megafree(void *pa)
+{
+  int i = ((uint64)pa - MEGABASE) / MEGAPGSIZE;
+
+  if(((uint64)pa % MEGAPGSIZE) != 0 || (uint64)pa < MEGABASE || (uint64)pa >= PHYSTOP)
+    panic("megafree");
+
+  acquire(&kmega.lock);
+  if(kmega.ref[i] != MEGAPGSIZE / PGSIZE)
+    panic("megafree: split");
+  kmega.ref[i] = 0;
+  release(&kmega.lock);
+}
+
+// Drop one 4096-byte piece of a split megapage.
+static void
+megaput(void *pa)
+{
+  int i = ((uint64)pa - MEGABASE) / MEGAPGSIZE;
+
+  acquire(&kmega.lock);
+  if(kmega.ref[i] <= 0)
+    panic("megaput");
+  kmega.ref[i]--;
+  release(&kmega.lock);
+}
+
+// Number of free pages. Doesn't take the lock, so it may be
+// a little stale.
+int
+kfreepages(void)
+{
+  return kmem.nfree;
+}
+
+// Fill in the allocator's part of *ms.
+void
+kmemstat(struct memstat *ms)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  ms->total = kmem.npages;
+  ms->free = kmem.nfree;
+  ms->zeroed = kmem.nzero;
+  ms->allocs = kmem.nalloc;
+  ms->fails = kmem.nfail;
+  ms->shared = 0;
+  for(i = 0; i < NELEM(kmem.ref); i++)
+    if(kmem.ref[i] > 1)
+      ms->shared++;
+  release(&kmem.lock);
+
+  acquire(&kmega.lock);
+  ms->megatotal = NHUGEPG;
+  ms->megafree = 0;
+  for(i = 0; i < NHUGEPG; i++)
+    if(kmega.ref[i] == 0)
+      ms->megafree++;
+  release(&kmega.lock);
+}
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -17,9 +18,22 @@
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls, reserves room
+// in the log for the MAXOPBLOCKS blocks the call may write,
+// and returns. But if it thinks the log is close to running
+// out, it sleeps until the logger has taken the transaction.
+// Calls that write more, such as big write()s, reserve as
+// much as they need with begin_opn() and end_opn(), up to
+// half the log, whose size mkfs puts in the superblock.
+//
+// Commits are group commits, done by the logger, a kernel
+// thread, not by the last end_op(): once no FS system call is
+// in the open transaction, the logger takes it, copying its
+// blocks into the log's bufs while begin_op() waits, then lets
+// FS system calls go on with a new open transaction while it
+// writes the old one to disk. Everything that finishes while
+// it writes joins the next commit. So end_op() returns before
+// its updates are on disk; fsync() waits for them.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,28 +42,48 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The log blocks, which are consecutive, go to the disk as
+// few requests, as does each run of consecutive home blocks.
+// The header is written alone, once the blocks before it are
+// done.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nblock;      // blocks the log holds: size-1, or LOGMAX
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they reserved.
+  int committing;  // the logger is taking the transaction, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;      // the open transaction
+  struct buf *buf[LOGMAX];  // and its blocks' bufs, which log_write() pinned
+  uint64 seq;      // number of the open transaction
+  uint64 done;     // transactions up to this one are on disk
+  uint64 nops;     // FS system calls, since boot
+  uint64 nwrite;   // log_write() calls, since boot
+  uint64 nabsorb;  // of those, for a block already in the transaction
+  uint64 ncommit;  // commits, since boot
 };
 struct log log;
 
+// The transaction the logger is writing, the log bufs that
+// hold copies of its blocks, and stand-ins for the blocks'
+// home locations that share their data.
+static struct logheader clh;
+static struct buf *cbuf[LOGMAX];
+static struct buf *lbuf[LOGMAX];
+static struct buf home[LOGMAX];
+
 static void recover_from_log(void);
-static void commit();
+static void logger(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -58,153 +92,290 @@ initlog(int dev, struct superblock *sb)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  for (int i = 0; i < LOGMAX; i++)
+    initsleeplock(&home[i].lock, "loghome");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.nblock = log.size - 1 < LOGMAX ? log.size - 1 : LOGMAX;
+  if (log.nblock < 2*MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.seq = 1;
+  // the bufs of a transaction being written, their copies
+  // in the log, the next transaction's, and some to spare.
+  bsetmin(3*log.nblock + MAXOPBLOCKS);
   recover_from_log();
+  kthread(logger, "logger");
+}
+
+// Read the n blocks of the log into lbuf[], locked, asking
+// the disk for all of those not cached at once.
+static void
+read_log(int n)
+{
+  static uint lblock[LOGMAX];
+  int i;
+
+  for (i = 0; i < n; i++)
+    lblock[i] = log.start+i+1;
+  breadahead(log.dev, lblock, n);
+  for (i = 0; i < n; i++)
+    lbuf[i] = bread(log.dev, log.start+i+1);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Writes from the log bufs, through the stand-ins, rather
+// than through the cached bufs of the home blocks, which FS
+// system calls of the next transaction may have changed.
 static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+install_trans(struct logheader *h)
+{
+  static struct buf *hb[LOGMAX];
+  int i;
+
+  for (i = 0; i < h->n; i++) {
+    hb[i] = &home[i];
+    acquiresleep(&home[i].lock);
+    home[i].dev = log.dev;
+    home[i].blockno = h->block[i];
+    home[i].data = lbuf[i]->data;
+  }
+  bwritestart(hb, h->n);  // write dst to disk
+  for (i = 0; i < h->n; i++) {
+    bwait(hb[i]);
+    releasesleep(&hb[i]->lock);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into *h
 static void
-read_head(void)
+read_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  h->n = lh->n;
+  for (i = 0; i < h->n; i++) {
+    h->block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write log header *h to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
+// Called from fsinit(), before any FS system call, when only
+// the superblock is cached; so installing from the log bufs
+// leaves no stale home block in the cache.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  read_head(&clh);
+  read_log(clh.n);
+  install_trans(&clh); // if committed, copy from log to disk
+  for (int i = 0; i < clh.n; i++)
+    brelse(lbuf[i]);
+  clh.n = 0;
+  write_head(&clh); // clear the log
 }
 
-// called at the start of each FS system call.
+// The most log blocks one FS system call may reserve.
+static int
+log_opmax(void)
+{
+  return log.nblock / 2;
+}
+
+// Log blocks to reserve for writing n bytes to a file: a
+// bitmap block for each data block, the i-node, the index
+// blocks over them, 2*NLEVEL-1 for a run that crosses from
+// one index block to the next, and more for runs longer
+// than an index block lists, and 2 blocks of slop for
+// non-aligned writes.
+int
+log_writeres(int n)
+{
+  int nb = (n + BSIZE - 1) / BSIZE;
+  int r = 2 * nb + 1 + 2 * (nb / NINDIRECT) + 2*NLEVEL - 1 + 2;
+
+  return r < MAXOPBLOCKS ? MAXOPBLOCKS : r;
+}
+
+// The most bytes one FS system call may write to a file.
+int
+log_writemax(void)
+{
+  int nb = (log_opmax() - 2*NLEVEL - 2) / 2;
+
+  while(log_writeres(nb * BSIZE) > log_opmax())
+    nb--;
+  return nb * BSIZE;
+}
+
+// called at the start of each FS system call that may
+// write up to n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log_opmax())
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.nblock){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
 {
-  int do_commit = 0;
+  begin_opn(MAXOPBLOCKS);
+}
 
+// called at the end of each FS system call that began
+// with begin_opn(n).
+// if this was the last outstanding operation, the
+// logger may commit.
+void
+end_opn(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
+  log.nops++;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0)
+    wakeup(&log.lh);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Wait until the updates of the FS system calls that have
+// finished are on disk.
+void
+log_sync(void)
+{
+  uint64 seq;
+
+  acquire(&log.lock);
+  // they are in the open transaction or, if that is
+  // empty, in the one the logger is writing, if any.
+  seq = log.lh.n > 0 ? log.seq : log.seq - 1;
+  while(log.done < seq)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
+}
+
+// Copy modified blocks from cache to log bufs.
+static void
+copy_log(void)
+{
+  int i;
+
+  read_log(clh.n);
+  for (i = 0; i < clh.n; i++) {
+    acquiresleep(&cbuf[i]->lock);
+    memmove(lbuf[i]->data, cbuf[i]->data, BSIZE);
+    releasesleep(&cbuf[i]->lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the transaction the logger took to disk.
 static void
-write_log(void)
+commit(void)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  bwritestart(lbuf, clh.n);  // write the log
+  for (i = 0; i < clh.n; i++)
+    bwait(lbuf[i]);
+  write_head(&clh);    // Write header to disk -- the real commit
+  install_trans(&clh); // Now install writes to home locations
+  for (i = 0; i < clh.n; i++) {
+    bunpin(cbuf[i]);
+    brelse(lbuf[i]);
   }
+  clh.n = 0;
+  write_head(&clh);    // Erase the transaction from the log
 }
 
+// The logger thread: commit each transaction once no FS
+// system call is in it, while the next one fills up.
 static void
-commit()
+logger(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  uint64 seq;
+
+  acquire(&log.lock);
+  for(;;){
+    while(log.lh.n == 0 || log.outstanding > 0)
+      sleep(&log.lh, &log.lock);
+
+    // take the transaction, and keep FS system calls out
+    // until its blocks are copied.
+    log.committing = 1;
+    memmove(&clh, &log.lh, sizeof(clh));
+    memmove(cbuf, log.buf, clh.n * sizeof(cbuf[0]));
+    seq = log.seq++;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    release(&log.lock);
+
+    copy_log();
+
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+
+    acquire(&log.lock);
+    log.done = seq;
+    log.ncommit++;
+    wakeup(&log.done);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// The logger will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,20 +388,36 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
+  log.nwrite++;
+  // log absorption: a block already in the open transaction
+  // is pinned, so it's still in b, which says so.
+  if (b->logseq == log.seq) {
+    log.nabsorb++;
+    release(&log.lock);
+    return;
   }
+  if (log.lh.n >= log.nblock)
+    panic("too big a transaction");
+  i = log.lh.n++;
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
-    log.lh.n++;
-  }
+  log.buf[i] = b;
+  b->logseq = log.seq;
+  bpin(b);
+  release(&log.lock);
+}
+
+// Fill in the log part of *ms.
+void
+logstat(struct memstat *ms)
+{
+  acquire(&log.lock);
+  ms->logops = log.nops;
+  ms->logcommits = log.ncommit;
+  ms->logwrites = log.nwrite;
+  ms->logabsorbs = log.nabsorb;
   release(&log.lock);
 }
 
@@ -17,8 +17,10 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    pcacheinit();    // shared read-only file pages
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space IDs
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -0,0 +1,41 @@
+// System-wide memory counters, filled in by memstat().
+// Counts are in 4096-byte pages unless noted.
+struct memstat {
+  uint64 total;     // pages the allocator manages
+  uint64 free;      // free pages, including zeroed ones
+  uint64 zeroed;    // free pages already zeroed
+  uint64 shared;    // pages in use with more than one reference
+  uint64 cached;    // pages held by the page cache
+  uint64 megatotal; // 2MB megapages in the pool
+  uint64 megafree;  // megapages free
+  uint64 allocs;    // kalloc() calls that succeeded, since boot
+  uint64 fails;     // kalloc() calls that found no memory
+  uint64 swaptotal; // page slots in the swap area
+  uint64 swapused;  // slots holding a page
+  uint64 swapouts;  // pages written to swap, since boot
+  uint64 swapins;   // pages read back from swap, since boot
+  uint64 bufs;      // disk blocks the buffer cache holds
+  uint64 bufmax;    // most it may grow to
+  uint64 bufhits;   // lookups that found the block cached, since boot
+  uint64 bufmisses; // lookups that had to recycle a buf
+  uint64 bufaheads; // blocks read ahead of sequential readers, since boot
+  uint64 bufacquires; // buffer cache lock acquisitions, since boot
+  uint64 bufwaits;    // of those, how many found the lock held
+  uint64 diskreqs;    // disk requests, since boot
+  uint64 diskdepthsum; // sum over them of the requests in flight, counting itself
+  uint64 diskmaxdepth; // most requests in flight at once
+  uint64 logops;      // FS system calls, since boot
+  uint64 logcommits;  // log commits, since boot
+  uint64 logwrites;   // log_write() calls, since boot
+  uint64 logabsorbs;  // of those, for a block the transaction already held
+};
+
+// One process's memory, filled in by memstat().
+struct procmem {
+  int pid;
+  int state;        // enum procstate
+  uint64 sz;        // size of the heap, bytes
+  uint64 rss;       // resident pages, including shared ones
+  uint64 shared;    // resident pages also mapped elsewhere
+  char name[16];
+};
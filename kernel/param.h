@@ -7,7 +7,21 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      128  // least blocks in the log mkfs makes, header included
+#define LOGFRAC      32   // and it makes the log up to 1/LOGFRAC of the file system
+#define MAXSEGS      16   // most consecutive blocks in one disk request
+#define NBUF         (MAXOPBLOCKS*3)  // least size of disk block cache, before initlog()
+#define BCACHEFRAC   16   // disk block cache may grow to 1/BCACHEFRAC of memory
+#define NBUCKET      13   // buffer cache hash buckets; 1 for one lock
+#define RAMAX        32   // most blocks read ahead of a sequential reader
+#define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#ifndef NHUGEPG
+#define NHUGEPG        0   // 2MB pages set aside for large user heaps; make NHUGEPG=n
+#endif
+#define NVMA         16   // mmap regions per process
+#define NPCACHE     256   // read-only file pages cached for sharing
+#define NZEROPG     256   // free pages kept zeroed for kalloc_zeroed()
+#define NSWAPPG    4096   // page slots in the swap area on disk
+#define SWAPBATCH     8   // pages swapout() frees per kalloc() shortfall
+#define PIPEMAXPG    16   // max pages in a pipe's ring buffer
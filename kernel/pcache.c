@@ -0,0 +1,198 @@
+//
+// Page cache for read-only file pages.
+//
+// When several processes run the same program, vmafault()
+// looks up each read-only text page here by (inode, offset)
+// and maps the one physical copy into all of them, taking
+// a reference with kdup(). The cache holds a reference of
+// its own, so a page stays cached after the last process
+// using it exits, until the inode is written or truncated
+// (pcacheinval()) or kalloc() runs out of memory and calls
+// pcachereclaim().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+struct cpage {
+  uint dev;
+  uint inum;        // 0 if the slot is free
+  uint off;         // file offset of the first byte
+  uint n;           // bytes from the file; the rest are zero
+  void *pa;
+  uint lastuse;     // pcache.clock at the last lookup
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  uint clock;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page holding n bytes of ip from off,
+// with a reference added for the caller, or 0.
+void*
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct cpage *c;
+  void *pa = 0;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == ip->inum && c->dev == ip->dev && c->off == off && c->n == n){
+      kdup(c->pa);
+      c->lastuse = ++pcache.clock;
+      pa = c->pa;
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Add page pa, holding n bytes of ip from off, to the cache.
+// The cache takes its own reference. If the cache is full of
+// pages in use, pa isn't cached. Caller holds ip->lock, so
+// that ip->pcached doesn't race with pcacheinval().
+void
+pcacheput(struct inode *ip, uint off, uint n, void *pa)
+{
+  struct cpage *c, *victim = 0;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == ip->inum && c->dev == ip->dev && c->off == off && c->n == n){
+      // someone else cached it first.
+      release(&pcache.lock);
+      return;
+    }
+    if(c->inum == 0){
+      // a free slot is best.
+      if(victim == 0 || victim->inum != 0)
+        victim = c;
+    } else if((victim == 0 || (victim->inum != 0 && c->lastuse < victim->lastuse)) &&
+              krefs(c->pa) == 1){
+      // else the least recently used page that no one maps.
+      // krefs() takes kmem.lock, so ask only about pages
+      // that would do.
+      victim = c;
+    }
+  }
+  if(victim == 0){
+    release(&pcache.lock);
+    return;
+  }
+  if(victim->inum != 0)
+    kfree(victim->pa);
+  kdup(pa);
+  victim->dev = ip->dev;
+  victim->inum = ip->inum;
+  victim->off = off;
+  victim->n = n;
+  victim->pa = pa;
+  victim->lastuse = ++pcache.clock;
+  ip->pcached = 1;
+  release(&pcache.lock);
+}
+
+// Drop ip's pages from the cache, since its contents are
+// about to change. Processes that map them keep their
+// copies. Caller holds ip->lock.
+void
+pcacheinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == ip->inum && c->dev == ip->dev){
+      kfree(c->pa);
+      memset(c, 0, sizeof(*c));
+    }
+  }
+  ip->pcached = 0;
+  release(&pcache.lock);
+}
+
+// Free every cached page that no process maps.
+// Returns the number of pages freed.
+int
+pcachereclaim(void)
+{
+  struct cpage *c;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum != 0 && krefs(c->pa) == 1){
+      kfree(c->pa);
+      memset(c, 0, sizeof(*c));
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Number of pages in the cache.
+int
+pcachecount(void)
+{
+  struct cpage *c;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++)
+    if(c->inum != 0)
+      n++;
+  release(&pcache.lock);
+  return n;
+}
+
+// Print, for each cached binary, how many pages are cached,
+// how many mappings share them, and the memory that saves
+// over every process having its own copy. Runs when user
+// types ^P on console. Doesn't take pcache.lock, to avoid
+// wedging a stuck machine further.
+void
+pcachedump(void)
+{
+  struct cpage *c, *d;
+  int pages, maps, saved, refs;
+
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == 0)
+      continue;
+    // report each inode once, at its first slot.
+    for(d = pcache.page; d < c; d++)
+      if(d->inum == c->inum && d->dev == c->dev)
+        break;
+    if(d < c)
+      continue;
+    pages = maps = saved = 0;
+    for(d = c; d < &pcache.page[NPCACHE]; d++){
+      if(d->inum != c->inum || d->dev != c->dev)
+        continue;
+      refs = krefspeek(d->pa) - 1;
+      pages++;
+      maps += refs;
+      if(refs > 1)
+        saved += refs - 1;
+    }
+    printf("pcache inode %d: %d pages, %d maps, %dKB saved\n",
+           c->inum, pages, maps, saved * (PGSIZE / 1024));
+  }
+}
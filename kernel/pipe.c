@@ -1,3 +1,27 @@
+//
+// Pipes.
+//
+// A pipe's data lives in a ring of pages: one to start with,
+// doubled up to PIPEMAXPG whenever a writer finds the ring
+// full, so that a pipe with a stream through it gets a big
+// buffer and one that carries the odd line stays small.
+//
+// Readers and writers copy straight between user memory and
+// the ring, a run within one page at a time, without holding
+// pi->lock, since copyin() and copyout() may fault. A read of
+// a whole page into a page-aligned buffer swaps the ring page
+// for the reader's page instead. splice() copies between a
+// file and the ring in the same way, so that data from a
+// file crosses the pipe without a trip through the sender's
+// user memory.
+//
+// Only one reader and one writer copy at a time (pi->reading
+// and pi->writing), which also keeps each read() and write()
+// whole. A sleeping reader is woken once half the ring is
+// full or the write ends; a sleeping writer once half the
+// ring is free or the read ends.
+//
+
 #include "types.h"
 #include "riscv.h"
 #include "defs.h"
@@ -8,17 +32,23 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
-
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPG];  // the ring
+  uint npage;     // pages in the ring, a power of two
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // 1 if a reader is in piperead(), 2 if others wait
+  int writing;    // 1 if a writer is in pipewrite(), 2 if others wait
+  int rcopy;      // the reader is copying out of the ring
+  int rwait;      // a reader sleeps on nread
+  int wwait;      // a writer sleeps on nwrite
 };
 
+#define RINGSIZE(pi) ((pi)->npage * PGSIZE)
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +60,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  if((pi->page[0] = kalloc()) == 0)
+    goto bad;
+  pi->npage = 1;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -68,63 +102,284 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    for(int i = 0; i < pi->npage; i++)
+      kfree(pi->page[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
-int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+// Double the ring of a full pipe, if it may grow and there
+// is memory. Called by the writer, holding pi->lock; kalloc()
+// won't sleep here. Returns 0 if the ring grew.
+static int
+pipegrow(struct pipe *pi)
+{
+  uint n = pi->npage, size = RINGSIZE(pi), p, off, m;
+  int i;
+
+  // a reader copying out of the ring may be reading a slot
+  // that the move below would let the writer reuse.
+  if(2*n > PIPEMAXPG || pi->rcopy)
+    return -1;
+  for(i = n; i < 2*n; i++){
+    if((pi->page[i] = kalloc()) == 0){
+      while(i-- > n){
+        kfree(pi->page[i]);
+        pi->page[i] = 0;
+      }
+      return -1;
+    }
+  }
+
+  // byte p moves from slot p % size to slot p % (2*size):
+  // the same slot, or one size further on, in a new page.
+  for(p = pi->nread; p != pi->nwrite; p += m){
+    off = p % size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->nwrite - p)
+      m = pi->nwrite - p;
+    if(p % (2*size) != off)
+      memmove(pi->page[(off + size) / PGSIZE] + off % PGSIZE,
+              pi->page[off / PGSIZE] + off % PGSIZE, m);
+  }
+  pi->npage = 2*n;
+  return 0;
+}
+
+// Where pipe data comes from or goes to: user memory at
+// addr, or, for splice(), file f at its offset.
+struct pipeio {
+  uint64 addr;
+  struct file *f;
+};
+
+// Copy m bytes from offset i of io into the ring at dst.
+// Returns the number copied, fewer at the end of a file,
+// or -1.
+static int
+ioin(struct pipeio *io, char *dst, int i, int m)
+{
+  struct inode *ip;
+  int r;
+
+  if(io->f == 0)
+    return copyin(myproc()->pagetable, dst, io->addr + i, m) == -1 ? -1 : m;
+  ip = io->f->ip;
+  ilock(ip);
+  if((r = readi(ip, 0, (uint64)dst, io->f->off, m)) > 0)
+    io->f->off += r;
+  iunlock(ip);
+  return r;
+}
+
+// Copy m bytes from the ring at src to offset i of io.
+// Returns the number copied, or -1. File writes are split
+// into transactions as in filewrite().
+static int
+ioout(struct pipeio *io, char *src, int i, int m)
 {
-  int i = 0;
+  int max = log_writemax();
+  int j, n1, r, res;
+  struct inode *ip;
+
+  if(io->f == 0)
+    return copyout(myproc()->pagetable, io->addr + i, src, m) == -1 ? -1 : m;
+  ip = io->f->ip;
+  for(j = 0; j < m; j += r){
+    n1 = m - j;
+    if(n1 > max)
+      n1 = max;
+    res = log_writeres(n1);
+    begin_opn(res);
+    ilock(ip);
+    if((r = writei(ip, 0, (uint64)src + j, io->f->off, n1)) > 0)
+      io->f->off += r;
+    iunlock(ip);
+    end_opn(res);
+    if(r != n1)
+      return r > 0 ? j + r : (j > 0 ? j : -1);
+  }
+  return m;
+}
+
+// Move up to n bytes from io into the pipe, waiting for room.
+static int
+pipeput(struct pipe *pi, struct pipeio *io, int n)
+{
+  int i = 0, m, r;
+  uint off;
+  char *dst;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
+  while(pi->writing){
+    if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    pi->writing = 2;
+    sleep(&pi->writing, &pi->lock);
+  }
+  pi->writing = 1;
+
+  while(i < n){
+    if(pi->readopen == 0 || killed(pr)){
+      i = -1;
+      break;
+    }
+    if(pi->nwrite == pi->nread + RINGSIZE(pi)){ //DOC: pipewrite-full
+      if(pipegrow(pi) == 0)
+        continue;
+      if(pi->rwait){
+        pi->rwait = 0;
+        wakeup(&pi->nread);
+      }
+      pi->wwait = 1;
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      continue;
     }
+
+    // copy in the run up to the end of the page or of the
+    // free space, without the lock, since copyin() may have
+    // to page in from an mmap()ed file, and readi() sleeps.
+    off = pi->nwrite % RINGSIZE(pi);
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->nread + RINGSIZE(pi) - pi->nwrite)
+      m = pi->nread + RINGSIZE(pi) - pi->nwrite;
+    if(m > n - i)
+      m = n - i;
+    dst = pi->page[off / PGSIZE] + off % PGSIZE;
+    release(&pi->lock);
+    r = ioin(io, dst, i, m);
+    acquire(&pi->lock);
+    if(r <= 0)
+      break;
+    pi->nwrite += r;
+    i += r;
+    if(pi->rwait && pi->nwrite - pi->nread >= RINGSIZE(pi) / 2){
+      pi->rwait = 0;
+      wakeup(&pi->nread);
+    }
+    if(r < m)
+      break;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
+  if(pi->rwait){
+    pi->rwait = 0;
+    wakeup(&pi->nread);
+  }
+  if(pi->writing == 2)
+    wakeup(&pi->writing);
+  pi->writing = 0;
+  release(&pi->lock);
   return i;
 }
 
-int
-piperead(struct pipe *pi, uint64 addr, int n)
+// Move up to n bytes out of the pipe to io, waiting until
+// there are some.
+static int
+pipeget(struct pipe *pi, struct pipeio *io, int n)
 {
-  int i;
+  int i = 0, m, r, flipped = 0;
+  uint off;
+  char *src;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->reading){
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
+    pi->reading = 2;
+    sleep(&pi->reading, &pi->lock);
+  }
+  pi->reading = 1;
+
+  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+    if(killed(pr)){
+      i = -1;
+      goto out;
+    }
+    pi->rwait = 1;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    off = pi->nread % RINGSIZE(pi);
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+
+    if(io->f == 0 && m == PGSIZE && (io->addr + i) % PGSIZE == 0 &&
+       !vmashared(pr, io->addr + i) &&
+       uvmexchange(pr->pagetable, io->addr + i, &pi->page[off / PGSIZE]) == 0){
+      // a whole page of data for a whole user page: trade
+      // the ring page for the user's instead of copying.
+      flipped = 1;
+      r = m;
+    } else {
+      // copy out without the lock, since copyout()
+      // may have to page in, and writei() sleeps.
+      src = pi->page[off / PGSIZE] + off % PGSIZE;
+      pi->rcopy = 1;
+      release(&pi->lock);
+      r = ioout(io, src, i, m);
+      acquire(&pi->lock);
+      pi->rcopy = 0;
+    }
+    if(r <= 0)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    pi->nread += r;
+    i += r;
+    if(pi->wwait && pi->nwrite - pi->nread <= RINGSIZE(pi) / 2){  //DOC: piperead-wakeup
+      pi->wwait = 0;
+      wakeup(&pi->nwrite);
+    }
+    if(r < m)
       break;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+
+ out:
+  if(flipped)
+    proc_flushtlb(pr);
+  if(pi->wwait){
+    pi->wwait = 0;
+    wakeup(&pi->nwrite);
+  }
+  if(pi->reading == 2)
+    wakeup(&pi->reading);
+  pi->reading = 0;
   release(&pi->lock);
   return i;
 }
+
+int
+pipewrite(struct pipe *pi, uint64 addr, int n)
+{
+  struct pipeio io = { addr, 0 };
+
+  return pipeput(pi, &io, n);
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n)
+{
+  struct pipeio io = { addr, 0 };
+
+  return pipeget(pi, &io, n);
+}
+
+// Move up to n bytes between pipe pi and file f, at f's
+// offset, copying once between the ring and the buffer
+// cache: from f into the pipe, or if tofile is set, from
+// the pipe into f.
+int
+pipesplice(struct pipe *pi, struct file *f, int n, int tofile)
+{
+  struct pipeio io = { 0, f };
+
+  return tofile ? pipeget(pi, &io, n) : pipeput(pi, &io, n);
+}
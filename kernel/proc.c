@@ -4,6 +4,7 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -20,6 +21,21 @@ static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// Address-space IDs. Each process gets an ASID from a
+// counter, so that its TLB entries survive trips into the
+// kernel and switches to other processes. When the counter
+// runs out, a new generation starts, and each cpu flushes
+// its whole TLB the first time it runs a process of the new
+// generation. A process whose page table loses translations
+// takes a fresh ASID (proc_flushtlb()), since its old
+// entries may linger in any cpu's TLB.
+struct {
+  struct spinlock lock;
+  uint64 gen;       // current generation, from 1
+  uint64 next;      // next ASID to hand out
+  uint64 n;         // number of ASIDs; 0 if satp has no ASID field
+} asids;
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -58,6 +74,85 @@ procinit(void)
   }
 }
 
+// Find out how many ASID bits satp implements, by writing
+// ones and reading back. Called once, on hart 0, with
+// paging on.
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+  int bits = 0;
+
+  initlock(&asids.lock, "asids");
+  w_satp(satp | SATP_ASID_MASK);
+  while(bits < 16 && (r_satp() & (1L << (SATP_ASID_SHIFT + bits))))
+    bits++;
+  w_satp(satp);
+  sfence_vma();
+
+  asids.gen = 1;
+  asids.next = 1;  // ASID 0 is the kernel's
+  asids.n = bits > 0 ? 1L << bits : 0;
+}
+
+// Return the satp value with which p runs in user space,
+// giving p a fresh ASID if it has none of the current
+// generation, and flushing this cpu's TLB if it belongs to
+// an older generation. Without ASIDs, sets *flush to tell
+// the trampoline to flush on every switch.
+// Interrupts must be disabled.
+uint64
+proc_satp(struct proc *p, int *flush)
+{
+  struct cpu *c = mycpu();
+  uint64 gen;
+
+  if(asids.n == 0){
+    *flush = 1;
+    return MAKE_SATP(p->pagetable);
+  }
+
+  // p's ASID is still good unless the generation moved on,
+  // which only happens under asids.lock. A rollover right
+  // after the check is no different from one right after the
+  // lock is released. p->asidgen can't change under us: p
+  // is running here, and the only other writers, such as
+  // swapout() calling proc_flushtlb(), hold p->lock and pick
+  // a p that isn't running, so they must keep doing both.
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if(p->asidgen != gen){
+    acquire(&asids.lock);
+    if(p->asidgen != asids.gen){
+      if(asids.next == asids.n){
+        __atomic_store_n(&asids.gen, asids.gen + 1, __ATOMIC_RELEASE);
+        asids.next = 1;
+      }
+      p->asid = asids.next++;
+      p->asidgen = asids.gen;
+    }
+    gen = asids.gen;
+    release(&asids.lock);
+  }
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  }
+  *flush = 0;
+  return MAKE_SATP_ASID(p->pagetable, p->asid);
+}
+
+// p's user page table has lost translations, or had
+// permissions taken away: don't let p use TLB entries
+// made before now. Caller is p, or holds p->lock and has
+// seen that p isn't RUNNING, since proc_satp() reads
+// p->asidgen without a lock.
+void
+proc_flushtlb(struct proc *p)
+{
+  p->asidgen = 0;
+}
+
 // Must be called with interrupts disabled,
 // to prevent race with process being moved
 // to a different CPU.
@@ -162,6 +257,9 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->asidgen = 0;
+  p->spawn = 0;
+  p->kthread = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -264,11 +362,15 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    // the heap must not run into the mmap() regions.
+    if(sz + n > vmabase(p))
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    proc_flushtlb(p);
   }
   p->sz = sz;
   return 0;
@@ -288,14 +390,19 @@ fork(void)
     return -1;
   }
 
+  // np is USED, so nothing else looks at it. Copying without
+  // np->lock lets kalloc() sleep to swap pages out.
+  release(&np->lock);
+
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
-  }
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)
+    goto bad;
   np->sz = p->sz;
 
+  // Copy the mmap() regions.
+  if(vmacopy(p, np) < 0)
+    goto bad;
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -312,6 +419,59 @@ fork(void)
 
   pid = np->pid;
 
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// Create a child that runs path with argv, after applying
+// file actions act[0..nact-1], like fork() then exec() but
+// without copying the parent's memory: the child starts out
+// with an empty address space and exec()s as soon as it
+// runs, in spawnret(). Waits for the exec() so as to report
+// its failure. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnact *act, int nact)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct spawn sp;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  sp.path = path;
+  sp.argv = argv;
+  sp.act = act;
+  sp.nact = nact;
+  sp.done = 0;
+  sp.ok = 0;
+  np->spawn = &sp;
+  np->context.ra = (uint64)spawnret;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
   release(&np->lock);
 
   acquire(&wait_lock);
@@ -322,7 +482,85 @@ fork(void)
   np->state = RUNNABLE;
   release(&np->lock);
 
-  return pid;
+  acquire(&wait_lock);
+  while(sp.done == 0)
+    sleep(&sp, &wait_lock);
+  if(!sp.ok){
+    // the child has exited, or is about to; reap it.
+    for(;;){
+      acquire(&np->lock);
+      if(np->state == ZOMBIE){
+        freeproc(np);
+        release(&np->lock);
+        break;
+      }
+      release(&np->lock);
+      sleep(p, &wait_lock);
+    }
+  }
+  release(&wait_lock);
+
+  return sp.ok ? pid : -1;
+}
+
+// A child created by spawn() first runs here, in place of
+// forkret(), to exec() what its parent asked for.
+void
+spawnret(void)
+{
+  struct proc *p = myproc();
+  struct spawn *sp = p->spawn;
+  int r;
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  r = spawnfiles(sp->act, sp->nact);
+  if(r == 0)
+    r = exec(sp->path, sp->argv);
+
+  // sp is on the parent's stack, which may be gone once
+  // the parent sees done.
+  acquire(&wait_lock);
+  p->spawn = 0;
+  sp->ok = r >= 0;
+  sp->done = 1;
+  release(&wait_lock);
+  wakeup(sp);
+
+  if(r < 0)
+    exit(-1);
+  p->trapframe->a0 = r;  // argc, as exec() returns it
+  usertrapret();
+}
+
+// A kernel thread's very first scheduling swtches here.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kthread();
+  panic("kthread returned");
+}
+
+// Start a process that runs fn in the kernel, and never
+// goes to user space or exits, such as the log's committer.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kthread = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
 }
 
 // Pass p's abandoned children to init.
@@ -351,6 +589,10 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap mmap() regions, writing back shared ones,
+  // while their files are still open.
+  vmaclear();
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -391,7 +633,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -408,15 +650,15 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = pp->xstate;
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          // copyout() may have to page in, so not
+          // while holding spinlocks.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&pp->lock);
@@ -452,6 +694,7 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
+    int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
       if(p->state == RUNNABLE) {
@@ -465,9 +708,14 @@ scheduler(void)
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        found = 1;
       }
       release(&p->lock);
     }
+    if(found == 0){
+      // nothing to run; zero a free page for kalloc_zeroed().
+      kzeroidle();
+    }
   }
 }
 
@@ -622,6 +870,37 @@ killed(struct proc *p)
   return k;
 }
 
+// Copy a struct procmem for each of the first n processes
+// out to user address addr. Returns the number copied, or
+// -1 on error.
+int
+procmem(uint64 addr, int n)
+{
+  struct proc *p, *me = myproc();
+  struct procmem pm;
+  int k = 0;
+
+  for(p = proc; p < &proc[NPROC] && k < n; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED || p->pagetable == 0){
+      release(&p->lock);
+      continue;
+    }
+    pm.pid = p->pid;
+    pm.state = p->state;
+    pm.sz = p->sz;
+    pm.rss = uvmresident(p->pagetable, &pm.shared);
+    safestrcpy(pm.name, p->name, sizeof(pm.name));
+    release(&p->lock);
+
+    // copyout() may have to page in, so not holding p->lock.
+    if(copyout(me->pagetable, addr + k*sizeof(pm), (char *)&pm, sizeof(pm)) < 0)
+      return -1;
+    k++;
+  }
+  return k;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -680,4 +959,5 @@ procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+  pcachedump();
 }
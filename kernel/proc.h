@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this cpu's TLB belongs to.
 };
 
 extern struct cpu cpus[NCPU];
@@ -77,10 +78,41 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_flush;  // flush the TLB on entry; set if no ASIDs
 };
 
+// A region of user memory set up by mmap(), or a program
+// segment loaded by exec(). Pages are allocated, and read
+// from the inode if there is one, when first touched;
+// see vmafault().
+struct vma {
+  uint64 addr;                 // Start, page-aligned
+  uint64 len;                  // Length in bytes, page-aligned; 0 if slot is free
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, maybe MAP_ANON or VMA_SEG
+  struct file *f;              // Mapped file, 0 if anonymous or a segment
+  struct inode *ip;            // Inode pages are read from, 0 if anonymous
+  uint off;                    // File offset of addr
+  uint filesz;                 // Bytes backed by the inode; the rest reads as zero
+};
+
+// a segment lies below p->sz, and its pages belong to the
+// process's ordinary memory once faulted in.
+#define VMA_SEG 0x1000
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// What a child created by spawn() is to run, on its
+// parent's kernel stack. The parent waits for done.
+struct spawn {
+  char *path;
+  char **argv;
+  struct spawnact *act;
+  int nact;
+  int done;         // set by the child once it has exec()ed or failed
+  int ok;           // the child is running path
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -99,9 +131,15 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint64 asid;                 // Address-space ID, valid if asidgen is current
+  uint64 asidgen;              // ASID generation of asid; 0 if none
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // mmap() regions
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct spawn *spawn;         // What to run, if created by spawn()
+  void (*kthread)(void);       // What to run, if a kernel thread
+  int pinned;                  // Don't swap out p's pages; see swap.c
 };
@@ -201,6 +201,13 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address-space ID tags TLB entries, so that switching
+// satp needn't flush them. the kernel uses ASID 0.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK (0xFFFFL << SATP_ASID_SHIFT)
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -256,6 +263,23 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
+#define COUNTEREN_TM (1L << 1)  // time CSR readable by the next mode down
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -327,6 +351,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush this hart's TLB entry for va in address space asid.
+static inline void
+sfence_vma_asid(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -338,11 +369,24 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+// a level-1 leaf PTE maps a 2MB megapage.
+#define MEGAPGSIZE (PGSIZE << 9)
+#define MEGAPGROUNDUP(sz)  (((sz)+MEGAPGSIZE-1) & ~(MEGAPGSIZE-1))
+#define MEGAPGROUNDDOWN(a) (((a)) & ~(MEGAPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_SWAP (1L << 8) // software: page is out in swap
+
+// an invalid PTE with PTE_SWAP set keeps the page's other
+// flags, and holds its swap slot where the PPN would be.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((pte) >> 10)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,6 +395,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a valid PTE with any of R/W/X set is a leaf; one with none
+// of them set points to the next level of the page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
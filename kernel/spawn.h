@@ -0,0 +1,15 @@
+// File actions for spawn(), applied in order in the child,
+// which starts with copies of all the parent's open files,
+// before it runs the program.
+#define SPAWN_CLOSE 1   // close(fd)
+#define SPAWN_DUP   2   // close(fd); make fd refer to arg's file
+#define SPAWN_OPEN  3   // close(fd); open(path, arg) as fd
+
+#define NSPAWNACT 8     // max actions per spawn()
+
+struct spawnact {
+  int op;
+  int fd;
+  int arg;
+  char *path;
+};
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics:
+  uint64 nacquire;   // times acquired
+  uint64 nwait;      // times acquire() found it held
 };
 
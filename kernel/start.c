@@ -46,6 +46,11 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let user programs read the time CSR (rdtime), to time
+  // themselves without a system call.
+  w_mcounteren(r_mcounteren() | COUNTEREN_TM);
+  w_scounteren(r_scounteren() | COUNTEREN_TM);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -0,0 +1,249 @@
+//
+// Page reclaim to a swap area on disk.
+//
+// When kalloc() runs out of memory and the page cache has
+// nothing to give back, swapout() looks for pages to evict
+// with a clock sweep over the page tables of processes that
+// aren't running: a page whose PTE_A is set gets a second
+// chance, and the bit cleared; one whose PTE_A is clear is
+// written to a free slot of the swap area, which mkfs puts
+// after the file system, and its PTE is replaced by one with
+// PTE_SWAP set and the slot number where the PPN was. The
+// next touch faults, and vmafault() calls swapin().
+// fork() shares slots between parent and child, and
+// uvmunmap() and vmaunmap() drop them.
+//
+// Left alone: pages with more than one reference (text,
+// the page cache), megapages, pages of MAP_SHARED regions,
+// which munmap() writes back to their file, and all pages of
+// a process whose kernel thread may hold physical addresses
+// of them (p->pinned), such as one that is itself in
+// swapout() in the middle of fork(), or preempted in the
+// kernel.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "memstat.h"
+#include "defs.h"
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  uint start;              // first block of the swap area
+  uint nslot;              // 0 if there's no swap area
+  uchar ref[NSWAPPG];      // swap PTEs that refer to each slot
+  uchar busy[NSWAPPG];     // slot is being written
+  int nused;               // slots with ref > 0
+  int hand;                // clock hand: index into proc[],
+  uint64 handva;           // and the next address to look at
+  uint64 nout;             // pages written to swap
+  uint64 nin;              // pages read back
+} swap;
+
+void
+swapinit(struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap < NSWAPPG ? sb->nswap : NSWAPPG;
+}
+
+// Allocate a slot, marked busy.
+// Returns its number, or -1 if swap is full.
+static int
+slotalloc(void)
+{
+  int slot = -1;
+
+  acquire(&swap.lock);
+  for(int i = 0; i < swap.nslot; i++){
+    if(swap.ref[i] == 0 && !swap.busy[i]){
+      swap.ref[i] = 1;
+      swap.busy[i] = 1;
+      swap.nused++;
+      slot = i;
+      break;
+    }
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// Add a reference to the slot of swap PTE pte.
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  swap.ref[PTE2SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to the slot of swap PTE pte. A slot still
+// being written isn't reused until the write is done.
+void
+swapput(pte_t pte)
+{
+  uint slot = PTE2SLOT(pte);
+
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapput");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Look for a page of p to evict, from *va on, clearing
+// PTE_A of each recently used page passed over. Returns
+// its PTE and sets *va, or returns 0 if there is none.
+// Caller holds p->lock.
+static pte_t*
+victim(struct proc *p, uint64 *va)
+{
+  pagetable_t l1, l0;
+  pte_t *pte;
+  uint64 a;
+  int cleared = 0;
+
+  for(a = PGROUNDDOWN(*va); a < TRAPFRAME; a += PGSIZE){
+    pte = &p->pagetable[PX(2, a)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      a = (a & ~((1L << PXSHIFT(2)) - 1)) + (1L << PXSHIFT(2)) - PGSIZE;
+      continue;
+    }
+    l1 = (pagetable_t)PTE2PA(*pte);
+    pte = &l1[PX(1, a)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      a = MEGAPGROUNDDOWN(a) + MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    l0 = (pagetable_t)PTE2PA(*pte);
+    pte = &l0[PX(0, a)];
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      cleared = 1;
+      continue;
+    }
+    if(krefs((void*)PTE2PA(*pte)) != 1 || vmashared(p, a))
+      continue;
+    *va = a;
+    break;
+  }
+  // make the hardware set PTE_A again on the next touch,
+  // rather than trust p's TLB entries.
+  if(cleared)
+    proc_flushtlb(p);
+  return a < TRAPFRAME ? pte : 0;
+}
+
+// Write up to n pages of processes other than the caller to
+// swap, and free them. Returns the number freed.
+// The caller must be able to sleep.
+int
+swapout(int n)
+{
+  struct proc *p, *me = myproc();
+  pte_t *pte;
+  uint64 va, pa;
+  int slot, done = 0, moves = 0;
+
+  if(swap.nslot == 0)
+    return 0;
+
+  me->pinned++;
+  // two turns of the clock: the first may only clear PTE_A.
+  while(done < n && moves <= 2*NPROC){
+    acquire(&swap.lock);
+    p = &proc[swap.hand];
+    va = swap.handva;
+    release(&swap.lock);
+
+    acquire(&p->lock);
+    pte = 0;
+    if((p->state == SLEEPING || p->state == RUNNABLE) &&
+       p->pinned == 0 && p->pagetable != 0)
+      pte = victim(p, &va);
+    if(pte == 0){
+      release(&p->lock);
+      acquire(&swap.lock);
+      if(swap.hand == p - proc){
+        swap.hand = (swap.hand + 1) % NPROC;
+        swap.handva = 0;
+      }
+      release(&swap.lock);
+      moves++;
+      continue;
+    }
+    if((slot = slotalloc()) < 0){
+      release(&p->lock);
+      break;
+    }
+    pa = PTE2PA(*pte);
+    *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    proc_flushtlb(p);
+    release(&p->lock);
+
+    acquire(&swap.lock);
+    if(swap.hand == p - proc)
+      swap.handva = va + PGSIZE;
+    release(&swap.lock);
+
+    virtio_disk_rwpage(swap.start + slot*(PGSIZE/BSIZE), (void*)pa, 1);
+    kfree((void*)pa);
+
+    acquire(&swap.lock);
+    swap.busy[slot] = 0;
+    swap.nout++;
+    release(&swap.lock);
+    wakeup(&swap.busy[slot]);
+    done++;
+  }
+  me->pinned--;
+  return done;
+}
+
+// Read the page that swap PTE *pte, of the current process,
+// refers to back into memory, and make *pte map it.
+// Returns 0, or -1 if out of memory.
+int
+swapin(pte_t *pte)
+{
+  uint slot = PTE2SLOT(*pte);
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+
+  // wait for swapout() to finish writing the slot.
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+
+  virtio_disk_rwpage(swap.start + slot*(PGSIZE/BSIZE), mem, 0);
+  swapput(*pte);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  return 0;
+}
+
+// Fill in the swap part of *ms.
+void
+swapstat(struct memstat *ms)
+{
+  acquire(&swap.lock);
+  ms->swaptotal = swap.nslot;
+  ms->swapused = swap.nused;
+  ms->swapouts = swap.nout;
+  ms->swapins = swap.nin;
+  release(&swap.lock);
+}
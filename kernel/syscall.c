@@ -107,6 +107,14 @@ extern uint64 sys_peterson_create(void);
 extern uint64 sys_peterson_acquire(void);
 extern uint64 sys_peterson_release(void);
 extern uint64 sys_peterson_destroy(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_fsync(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -138,6 +146,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_peterson_acquire] sys_peterson_acquire,
 [SYS_peterson_release] sys_peterson_release,
 [SYS_peterson_destroy] sys_peterson_destroy,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_memstat] sys_memstat,
+[SYS_spawn]   sys_spawn,
+[SYS_madvise] sys_madvise,
+[SYS_lseek]   sys_lseek,
+[SYS_splice]  sys_splice,
+[SYS_fsync]   sys_fsync,
 };
 
 void
@@ -25,4 +25,12 @@
 #define SYS_peterson_create 22
 #define SYS_peterson_acquire 23
 #define SYS_peterson_release 24
-#define SYS_peterson_destroy 25
\ No newline at end of file
+#define SYS_peterson_destroy 25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_memstat 28
+#define SYS_spawn  29
+#define SYS_madvise 30
+#define SYS_lseek  31
+#define SYS_splice 32
+#define SYS_fsync  33
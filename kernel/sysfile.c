@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +95,44 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
+
+// Wait until what has been written to the file system,
+// including through fd, is on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
 uint64
 sys_close(void)
 {
@@ -301,18 +340,14 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode as the lowest free file
+// descriptor. Returns the descriptor, or -1.
+static int
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -335,6 +370,14 @@ sys_open(void)
     }
   }
 
+  // a running program pages its text in from its file.
+  if(ip->type == T_FILE && (omode & (O_WRONLY|O_RDWR|O_TRUNC|O_EXTENT)) &&
+     itextbusy(ip)){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
@@ -363,6 +406,12 @@ sys_open(void)
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
+  if((omode & O_EXTENT) && ip->type == T_FILE && ip->size == 0 &&
+     (ip->flags & I_EXTENT) == 0){
+    itrunc(ip);  // blocks a failed write left
+    ip->flags |= I_EXTENT;
+    iupdate(ip);
+  }
 
   iunlock(ip);
   end_op();
@@ -370,6 +419,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return openfile(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -431,20 +492,25 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Free the strings fetchargv() fetched.
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Fetch the user argv[] array at uargv into argv[MAXARG],
+// a page per string. Returns 0, or -1 with argv freed.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,18 +526,125 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
+
+ bad:
+  freeargv(argv);
+  return -1;
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
 
   int ret = exec(path, argv);
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  freeargv(argv);
+  return ret;
+}
 
+// spawn(path, argv, act, nact): start a child running
+// path, without copying this process's memory. The child
+// applies the nact file actions in act[] first.
+// Returns the child's pid, or -1 if it couldn't run path.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG], *kpath;
+  struct spawnact *act;
+  uint64 uargv, uact;
+  int nact, i, ret = -1;
+
+  argaddr(1, &uargv);
+  argaddr(2, &uact);
+  argint(3, &nact);
+  if(nact < 0 || nact > NSPAWNACT)
+    return -1;
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+
+  // the actions, followed by the paths they open.
+  if((act = kalloc()) == 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0){
+    kfree(act);
+    return -1;
+  }
+  if(copyin(myproc()->pagetable, (char*)act, uact, nact*sizeof(*act)) < 0)
+    goto out;
+  kpath = (char*)&act[NSPAWNACT];
+  for(i = 0; i < nact; i++){
+    if(act[i].op == SPAWN_OPEN){
+      if(fetchstr((uint64)act[i].path, kpath, MAXPATH) < 0)
+        goto out;
+      act[i].path = kpath;
+      kpath += MAXPATH;
+    }
+  }
+
+  ret = spawn(path, argv, act, nact);
+
+ out:
+  freeargv(argv);
+  kfree(act);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// Apply spawn() file actions to the current process,
+// which is a child that spawn() created.
+// Returns 0, or -1 if an action failed.
+int
+spawnfiles(struct spawnact *act, int nact)
+{
+  struct proc *p = myproc();
+  struct spawnact *a;
+  struct file *f = 0;
+  int fd;
+
+  for(a = act; a < &act[nact]; a++){
+    if(a->fd < 0 || a->fd >= NOFILE)
+      return -1;
+    if(a->op == SPAWN_DUP){
+      if(a->arg < 0 || a->arg >= NOFILE || (f = p->ofile[a->arg]) == 0)
+        return -1;
+      if(a->arg == a->fd)
+        continue;
+      filedup(f);
+    }
+    if(p->ofile[a->fd]){
+      fileclose(p->ofile[a->fd]);
+      p->ofile[a->fd] = 0;
+    }
+    switch(a->op){
+    case SPAWN_CLOSE:
+      break;
+    case SPAWN_DUP:
+      p->ofile[a->fd] = f;
+      break;
+    case SPAWN_OPEN:
+      // the lowest free descriptor is a->fd, unless lower
+      // ones are free too; move it if so.
+      if((fd = openfile(a->path, a->arg)) < 0)
+        return -1;
+      if(fd != a->fd){
+        p->ofile[a->fd] = p->ofile[fd];
+        p->ofile[fd] = 0;
+      }
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
 }
 
 uint64
@@ -503,3 +676,45 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f = 0;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  // the kernel always chooses the address.
+  if(addr != 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANON) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+uint64
+sys_madvise(void)
+{
+  uint64 addr, len;
+  int advice;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &advice);
+  return madvise(addr, len, advice);
+}
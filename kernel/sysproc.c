@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
 
 uint64
 sys_exit(void)
@@ -90,6 +91,33 @@ sys_uptime(void)
   return xticks;
 }
 
+// memstat(struct memstat *ms, struct procmem *pm, int n):
+// fill in *ms, and up to n entries of pm, one per process.
+// Returns the number of pm entries filled in.
+uint64
+sys_memstat(void)
+{
+  struct memstat ms;
+  uint64 msaddr, pmaddr;
+  int n;
+
+  argaddr(0, &msaddr);
+  argaddr(1, &pmaddr);
+  argint(2, &n);
+
+  kmemstat(&ms);
+  ms.cached = pcachecount();
+  swapstat(&ms);
+  bstat(&ms);
+  logstat(&ms);
+  virtio_disk_stat(&ms);
+  if(copyout(myproc()->pagetable, msaddr, (char *)&ms, sizeof(ms)) < 0)
+    return -1;
+  if(n <= 0)
+    return 0;
+  return procmem(pmaddr, n);
+}
+
 /* Added for Task 1 - Peterson Lock System Call Implementations */
 
 uint64
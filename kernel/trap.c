@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fcntl.h"
 
 struct spinlock tickslock;
 uint ticks;
@@ -29,6 +30,39 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// Handle a user page fault by paging in from one of p's
+// mmap() regions. Returns 0 if the fault was handled, -1 if
+// scause isn't a page fault or the region (if any) doesn't
+// allow the access.
+static int
+pagefault(struct proc *p)
+{
+  uint64 va = r_stval();
+  int access, perm;
+  pte_t *pte;
+
+  switch(r_scause()){
+  case 12: access = PROT_EXEC; perm = PTE_X; break;   // instruction page fault
+  case 13: access = PROT_READ; perm = PTE_R; break;   // load page fault
+  case 15: access = PROT_WRITE; perm = PTE_W; break;  // store/AMO page fault
+  default: return -1;
+  }
+
+  // with ASIDs, trips through the kernel no longer flush
+  // p's TLB entries, so the fault may be spurious: the TLB
+  // may still hold what va's PTE said before the kernel
+  // mapped it (e.g. sbrk() or copyout()). flush the one
+  // page and retry.
+  pte = va < MAXVA ? walk(p->pagetable, va, 0) : 0;
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|perm)) != (PTE_V|PTE_U|perm)){
+    if(vmafault(p->pagetable, va, access) < 0)
+      return -1;
+  }
+  if(p->asidgen != 0)
+    sfence_vma_asid(PGROUNDDOWN(va), p->asid);
+  return 0;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -67,6 +101,8 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(pagefault(p) == 0){
+    // paged in from an mmap() region
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -119,14 +155,17 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and whether to flush the TLB on the way out and back in.
+  int flush;
+  uint64 satp = proc_satp(p, &flush);
+  p->trapframe->kernel_flush = flush;
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, flush);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -151,8 +190,14 @@ kerneltrap()
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // the interrupted kernel code may be in the middle of a
+  // copy to or from user memory, so keep swapout() away
+  // from the process's pages meanwhile.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->pinned++;
     yield();
+    myproc()->pinned--;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -46,8 +46,8 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and at least MAXSEGS+2.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
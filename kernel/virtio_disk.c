@@ -2,6 +2,15 @@
 // driver for qemu's virtio disk device.
 // uses qemu's mmio interface to virtio.
 //
+// requests are asynchronous: virtio_disk_start() queues one
+// and returns, and virtio_disk_intr() frees its descriptors
+// when the device is done and either calls the request's done
+// function or wakes up virtio_disk_wait(). so up to NUM/3
+// requests, from any number of callers, can be in flight.
+// a request for a run of up to MAXSEGS consecutive blocks
+// chains one data descriptor per buf, so that the device
+// moves them all in one go.
+//
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
 
@@ -15,6 +24,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "memstat.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -46,15 +56,24 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;     // a page request's flag
+    void (*done)(struct buf *);  // for virtio_disk_start()
     char status;
   } info[NUM];
 
+  // the buf whose data each data descriptor points at.
+  struct buf *dbuf[NUM];
+
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
+
+  int inflight;     // requests the device has
+  int maxdepth;     // most requests in flight at once
+  uint64 nreq;      // requests since boot
+  uint64 depthsum;  // sum of inflight as each request was queued
   
 } disk;
 
@@ -118,14 +137,11 @@ virtio_disk_init(void)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
+  disk.desc = kalloc_zeroed();
+  disk.avail = kalloc_zeroed();
+  disk.used = kalloc_zeroed();
   if(!disk.desc || !disk.avail || !disk.used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
 
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
@@ -196,12 +212,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +227,37 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Queue a request to read or write the disk at sector, and
+// tell the device. The memory is the data of the n bufs at
+// b, for consecutive blocks, each of which has b->disk set
+// while the disk owns it; or, if b is 0, the len bytes at
+// data, with *busy set. When the disk is done with a buf,
+// done(b) is called, if done isn't 0.
+// Caller holds disk.vdisk_lock.
+static void
+disk_start(uint64 sector, int write, struct buf **b, int n,
+           void *data, uint len, int *busy, void (*done)(struct buf *))
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // descriptors: one for type/reserved/sector, one or more for
+  // the data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  if(b == 0)
+    n = 1;
+  if(n < 1 || n > MAXSEGS)
+    panic("disk_start");
+
+  // allocate the descriptors.
+  int idx[MAXSEGS+2];
+  int nd = n + 2;
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(allocn_desc(idx, nd) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +274,44 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    int d = idx[i];
+    if(b){
+      if(i > 1 && b[i-1]->blockno != b[i-2]->blockno + 1)
+        panic("disk_start: not consecutive");
+      disk.desc[d].addr = (uint64) b[i-1]->data;
+      disk.desc[d].len = BSIZE;
+      b[i-1]->disk = 1;
+      disk.dbuf[d] = b[i-1];
+    } else {
+      disk.desc[d].addr = (uint64) data;
+      disk.desc[d].len = len;
+    }
+    if(write)
+      disk.desc[d].flags = 0; // device reads the data
+    else
+      disk.desc[d].flags = VRING_DESC_F_WRITE; // device writes the data
+    disk.desc[d].flags |= VRING_DESC_F_NEXT;
+    disk.desc[d].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[nd-1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[nd-1]].len = 1;
+  disk.desc[idx[nd-1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[nd-1]].next = 0;
+
+  // record the busy flag and done function for virtio_disk_intr().
+  if(b == 0)
+    *busy = 1;
+  disk.info[idx[0]].busy = b ? 0 : busy;
+  disk.info[idx[0]].done = done;
+
+  disk.inflight++;
+  if(disk.inflight > disk.maxdepth)
+    disk.maxdepth = disk.inflight;
+  disk.nreq++;
+  disk.depthsum += disk.inflight;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -279,15 +324,59 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+  disk_start(b->blockno * (BSIZE / 512), write, &b, 1, 0, 0, 0, 0);
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+    sleep(&b->disk, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// Start reading or writing the n bufs at b, which hold
+// consecutive blocks, in one request, and return without
+// waiting. When the disk is done, virtio_disk_intr() calls
+// done() for each buf, in interrupt context, holding
+// disk.vdisk_lock; or, if done is 0, the caller must call
+// virtio_disk_wait() for each.
+void
+virtio_disk_start(struct buf **b, int n, int write, void (*done)(struct buf *))
+{
+  acquire(&disk.vdisk_lock);
+  disk_start(b[0]->blockno * (BSIZE / 512), write, b, n, 0, 0, 0, done);
+  release(&disk.vdisk_lock);
+}
+
+// Wait for the disk to finish with b, after
+// virtio_disk_start() without a done function.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1)
+    sleep(&b->disk, &disk.vdisk_lock);
+  release(&disk.vdisk_lock);
+}
+
+// Read or write a page of memory at pa, from or to the
+// PGSIZE/BSIZE blocks starting at blockno, bypassing the
+// buffer cache. Used for swap.
+void
+virtio_disk_rwpage(uint blockno, void *pa, int write)
+{
+  int busy;
 
+  acquire(&disk.vdisk_lock);
+  disk_start((uint64)blockno * (BSIZE / 512), write, 0, 1, pa, PGSIZE, &busy, 0);
+  while(busy == 1)
+    sleep(&busy, &disk.vdisk_lock);
   release(&disk.vdisk_lock);
 }
 
@@ -316,12 +405,46 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    int *busy = disk.info[id].busy;
+    void (*done)(struct buf *) = disk.info[id].done;
+    disk.info[id].busy = 0;
+    disk.info[id].done = 0;
+
+    // the disk is done with the data: tell whoever
+    // waits for each buf, or for the page.
+    for(int i = id; ; i = disk.desc[i].next){
+      struct buf *b = disk.dbuf[i];
+      if(b){
+        disk.dbuf[i] = 0;
+        b->disk = 0;
+        if(done)
+          done(b);
+        else
+          wakeup(&b->disk);
+      }
+      if((disk.desc[i].flags & VRING_DESC_F_NEXT) == 0)
+        break;
+    }
+    if(busy){
+      *busy = 0;
+      wakeup(busy);
+    }
+    free_chain(id);
+    disk.inflight--;
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
 }
+
+// Fill in the disk queue part of *ms.
+void
+virtio_disk_stat(struct memstat *ms)
+{
+  acquire(&disk.vdisk_lock);
+  ms->diskreqs = disk.nreq;
+  ms->diskdepthsum = disk.depthsum;
+  ms->diskmaxdepth = disk.maxdepth;
+  release(&disk.vdisk_lock);
+}
@@ -5,6 +5,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "fcntl.h"
 
 /*
  * the kernel's page table.
@@ -21,8 +22,7 @@ kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -37,6 +37,9 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() covers everything from the first 2MB boundary
+  // past etext up to PHYSTOP with megapages, so the direct map
+  // takes few TLB entries.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -82,24 +85,41 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
-pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+//
+// A leaf PTE may also sit at level 1, mapping a 2MB megapage.
+// walkto() stops at such a leaf, or at level target, and
+// sets *level (if level is non-zero) to the level it
+// stopped at.
+static pte_t *
+walkto(pagetable_t pagetable, uint64 va, int alloc, int target, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > target; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        if(level)
+          *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  if(level)
+    *level = target;
+  return &pagetable[PX(target, va)];
+}
+
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walkto(pagetable, va, alloc, 0, 0);
 }
 
 // Look up a virtual address, return the physical address,
@@ -110,11 +130,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkto(pagetable, va, 0, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -122,6 +143,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level > 0)
+    pa += PGROUNDDOWN(va) & ((1L << PXSHIFT(level)) - 1);
   return pa;
 }
 
@@ -137,13 +160,16 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// be page-aligned. Wherever va and pa are both 2MB-aligned and
+// a whole megapage fits in what is left of the range, a single
+// level-1 leaf is used instead of 512 4KB leaves. Returns 0 on
+// success, -1 if walk() couldn't allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, sz;
   pte_t *pte;
+  int level;
 
   if(size == 0)
     panic("mappages: size");
@@ -151,38 +177,68 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    level = 0;
+    if((a % MEGAPGSIZE) == 0 && (pa % MEGAPGSIZE) == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE)
+      level = 1;
+    if((pte = walkto(pagetable, a, 1, level, 0)) == 0)
       return -1;
+    if(level == 1 && (*pte & PTE_V) && !PTE_LEAF(*pte)){
+      // part of this 2MB is already mapped with 4KB pages.
+      level = 0;
+      if((pte = walk(pagetable, a, 1)) == 0)
+        return -1;
+    }
+    sz = 1L << PXSHIFT(level);
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < sz)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += sz;
+    pa += sz;
   }
   return 0;
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages of exec()ed program segments that were
+// never touched aren't mapped, and are skipped. A megapage
+// must lie wholly inside the range.
+// Optionally free the physical memory, and the swap slots
+// of pages that are out in swap.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+    if((pte = walkto(pagetable, a, 0, 0, &level)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapput(*pte);
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level > 0){
+      if((a % MEGAPGSIZE) != 0 || a + MEGAPGSIZE > va + npages*PGSIZE)
+        panic("uvmunmap: part of a megapage");
+      if(do_free)
+        megafree((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
@@ -197,10 +253,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,14 +269,37 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
+// Map a zeroed megapage at va, which must be 2MB-aligned.
+// Returns 0 on success, -1 if no megapage is free or the
+// level-1 slot for va already holds a page-table page.
+static int
+uvmallocmega(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  char *mem;
+
+  pte = walkto(pagetable, va, 0, 1, 0);
+  if(pte != 0 && (*pte & PTE_V))
+    return -1;
+  if((mem = megaalloc()) == 0)
+    return -1;
+  memset(mem, 0, MEGAPGSIZE);
+  if(mappages(pagetable, va, MEGAPGSIZE, (uint64)mem, perm) != 0){
+    megafree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Writable 2MB-aligned stretches (large heaps) get megapages
+// while the pool lasts.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
@@ -233,12 +311,17 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(NHUGEPG > 0 && (xperm & PTE_W) && (a % MEGAPGSIZE) == 0 &&
+       newsz - a >= MEGAPGSIZE &&
+       uvmallocmega(pagetable, a, PTE_R|PTE_U|xperm) == 0){
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -248,10 +331,92 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Replace the megapage leaf covering va, if there is one, with a
+// page-table page of 4KB leaves onto the same memory, so that
+// part of it can be unmapped. Returns 0 on success, -1 if a
+// page-table page couldn't be allocated.
+static int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  uint64 pa;
+  int level;
+
+  pte = walkto(pagetable, va, 0, 0, &level);
+  if(pte == 0 || level == 0 || (*pte & PTE_V) == 0)
+    return 0;
+  if((l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(l0) | PTE_V;
+  return 0;
+}
+
+// Free the user pages in [va, va+npages*PGSIZE), for madvise(),
+// leaving their PTEs invalid. Pages without PTE_U, such as the
+// stack guard page, stay. Returns 0, or -1 if a megapage at
+// either end couldn't be split.
+int
+uvmdiscard(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, end = va + npages*PGSIZE;
+  pte_t *pte;
+  int level;
+
+  if((va % PGSIZE) != 0)
+    panic("uvmdiscard: not aligned");
+  if(uvmsplit(pagetable, va) < 0 || (end < MAXVA && uvmsplit(pagetable, end) < 0))
+    return -1;
+
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walkto(pagetable, a, 0, 0, &level)) == 0)
+      continue;
+    if((*pte & PTE_SWAP) == 0 && (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(level > 0){
+      // both ends were split, so the megapage is inside.
+      uvmunmap(pagetable, a, MEGAPGSIZE/PGSIZE, 1);
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    uvmunmap(pagetable, a, 1, 1);
+  }
+  return 0;
+}
+
+// Swap the page that user address va maps with the page at
+// *pa, so that piperead() can hand over a page of data
+// without copying it. Only a writable 4KB page that nothing
+// else maps is swapped. Returns 0 with *pa set to the old
+// page, or -1. The caller must flush the TLB.
+int
+uvmexchange(pagetable_t pagetable, uint64 va, char **pa)
+{
+  pte_t *pte;
+  char *old;
+  int level;
+
+  if(va >= MAXVA || (va % PGSIZE) != 0)
+    return -1;
+  pte = walkto(pagetable, va, 0, 0, &level);
+  if(pte == 0 || level != 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return -1;
+  old = (char*)PTE2PA(*pte);
+  if(krefs(old) != 1)
+    return -1;
+  *pte = PA2PTE(*pa) | PTE_FLAGS(*pte);
+  *pa = old;
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, which stays oldsz
+// if a megapage straddling newsz could not be split.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -259,6 +424,9 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    if((PGROUNDUP(newsz) % MEGAPGSIZE) != 0 &&
+       uvmsplit(pagetable, PGROUNDUP(newsz)) < 0)
+      return oldsz;
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
@@ -266,6 +434,33 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// Recursive helper for uvmresident(): count leaves under
+// pagetable, a level-level table mapping from va.
+static uint64
+resident(pagetable_t pagetable, int level, uint64 va, uint64 *shared)
+{
+  uint64 n = 0, a;
+
+  if(level == 2)
+    *shared = 0;
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    a = va + ((uint64)i << PXSHIFT(level));
+    if((pte & PTE_V) == 0 || a >= TRAPFRAME)
+      continue;
+    if(!PTE_LEAF(pte)){
+      n += resident((pagetable_t)PTE2PA(pte), level - 1, a, shared);
+    } else if(level > 0){
+      n += 1L << (PXSHIFT(level) - PGSHIFT);
+    } else {
+      n++;
+      if(krefs((void*)PTE2PA(pte)) > 1)
+        (*shared)++;
+    }
+  }
+  return n;
+}
+
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
 void
@@ -286,6 +481,16 @@ freewalk(pagetable_t pagetable)
   kfree((void*)pagetable);
 }
 
+// Count the pages mapped below TRAPFRAME in a user page
+// table, and how many of those have more than one reference
+// (shared text, pages shared with the page cache).
+// A megapage counts as 512 pages, none of them shared.
+uint64
+uvmresident(pagetable_t pagetable, uint64 *shared)
+{
+  return resident(pagetable, 2, 0, shared);
+}
+
 // Free user memory pages,
 // then free page-table pages.
 void
@@ -296,30 +501,88 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
+// Copy the megapage at physical address pa into new at va,
+// as a megapage if the pool has one, otherwise as 4KB pages.
+// Returns 0 on success, -1 on failure, having undone
+// its own mappings.
+static int
+uvmcopymega(pagetable_t new, uint64 va, uint64 pa, uint flags)
+{
+  char *mem;
+  uint64 off;
+
+  if((mem = megaalloc()) != 0){
+    memmove(mem, (char*)pa, MEGAPGSIZE);
+    if(mappages(new, va, MEGAPGSIZE, (uint64)mem, flags) == 0)
+      return 0;
+    megafree(mem);
+  }
+
+  for(off = 0; off < MEGAPGSIZE; off += PGSIZE){
+    if((mem = kalloc()) == 0)
+      goto err;
+    memmove(mem, (char*)pa + off, PGSIZE);
+    if(mappages(new, va + off, PGSIZE, (uint64)mem, flags) != 0){
+      kfree(mem);
+      goto err;
+    }
+  }
+  return 0;
+
+ err:
+  if(off > 0)
+    uvmunmap(new, va, off / PGSIZE, 1);
+  return -1;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory, except that read-only
+// pages are shared.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
   char *mem;
+  int level;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    // the child faults in untouched segment pages itself.
+    if((pte = walkto(old, i, 0, 0, &level)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      // share the swap slot; each swaps in its own copy.
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(*pte);
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    if(level > 0){
+      if(uvmcopymega(new, i, pa, flags) != 0)
+        goto err;
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    if((flags & PTE_W) == 0){
+      // nothing writes a read-only page, such as
+      // program text; parent and child share it.
+      kdup((void*)pa);
+      mem = (char*)pa;
+    } else {
+      if((mem = kalloc()) == 0)
+        goto err;
+      memmove(mem, (char*)pa, PGSIZE);
+    }
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
@@ -339,101 +602,151 @@ uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
+  if(uvmsplit(pagetable, va) < 0)
+    panic("uvmclear: split");
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
 }
 
-// Copy from kernel to user.
-// Copy len bytes from src to virtual address dstva in a given page table.
+// A run of user memory that is contiguous in physical memory.
+struct useg {
+  uint64 pa;
+  uint64 len;
+};
+
+#define NUSEG 8   // segments resolved per uresolve()
+
+// The copy engine behind copyin(), copyout() and copyinstr().
+// Resolve as much of user range [va, va+len) as fits in NUSEG
+// physically contiguous segments, stopping at the first page
+// that isn't mapped with the needed permissions and can't be
+// paged in from an mmap() region or swap. Only the first page
+// is paged in; later ones wait for the next call. Consecutive
+// pages under one page-table page are read with pte++ rather
+// than a new walk.
+// Returns the number of bytes resolved from va, 0 if none.
+static uint64
+uresolve(pagetable_t pagetable, uint64 va, uint64 len, int write,
+         struct useg *seg, int *nseg)
+{
+  uint64 done = 0, pa, n, size;
+  pte_t *pte = 0;
+  int level = 0, faulted = 0;
+  int perm = PTE_V | PTE_U | (write ? PTE_W : 0);
+
+  *nseg = 0;
+  while(done < len && va < MAXVA){
+    if(pte == 0 || level != 0 || PX(0, va) == 0)
+      pte = walkto(pagetable, va, 0, 0, &level);
+    else
+      pte++;
+    if(pte == 0 || (*pte & perm) != perm){
+      // vmafault() may sleep, and swapout() may take the pages
+      // already resolved meanwhile; let the caller copy first.
+      if(faulted || done > 0)
+        break;
+      if(vmafault(pagetable, va, write ? PROT_WRITE : PROT_READ) < 0)
+        break;
+      faulted = 1;
+      pte = 0;
+      continue;
+    }
+    faulted = 0;
+
+    size = 1L << PXSHIFT(level);
+    pa = PTE2PA(*pte) + (va & (size - 1));
+    n = size - (va & (size - 1));
+    if(n > len - done)
+      n = len - done;
+    if(*nseg > 0 && seg[*nseg-1].pa + seg[*nseg-1].len == pa){
+      seg[*nseg-1].len += n;
+    } else if(*nseg < NUSEG){
+      seg[*nseg].pa = pa;
+      seg[*nseg].len = n;
+      (*nseg)++;
+    } else {
+      break;
+    }
+    done += n;
+    va += n;
+  }
+  return done;
+}
+
+// Copy len bytes between kernel address kva and user address
+// uva: to user space if write is set, else from it.
 // Return 0 on success, -1 on error.
-int
-copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+static int
+ucopy(pagetable_t pagetable, uint64 uva, char *kva, uint64 len, int write)
 {
-  uint64 n, va0, pa0;
+  struct useg seg[NUSEG];
+  uint64 n;
+  int nseg;
 
   while(len > 0){
-    va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((n = uresolve(pagetable, uva, len, write, seg, &nseg)) == 0)
       return -1;
-    n = PGSIZE - (dstva - va0);
-    if(n > len)
-      n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
-
+    for(int i = 0; i < nseg; i++){
+      if(write)
+        memmove((void *)seg[i].pa, kva, seg[i].len);
+      else
+        memmove(kva, (void *)seg[i].pa, seg[i].len);
+      kva += seg[i].len;
+    }
+    uva += n;
     len -= n;
-    src += n;
-    dstva = va0 + PGSIZE;
   }
   return 0;
 }
 
+// Copy from kernel to user.
+// Copy len bytes from src to virtual address dstva in a given page table.
+// Return 0 on success, -1 on error.
+int
+copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  return ucopy(pagetable, dstva, src, len, 1);
+}
+
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
-
-  while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > len)
-      n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
-
-    len -= n;
-    dst += n;
-    srcva = va0 + PGSIZE;
-  }
-  return 0;
+  return ucopy(pagetable, srcva, dst, len, 0);
 }
 
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
+// Resolves a page at a time, so as not to page in memory
+// past the end of the string.
 // Return 0 on success, -1 on error.
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
+  struct useg seg[NUSEG];
+  uint64 n;
+  int nseg;
 
-  while(got_null == 0 && max > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
-    n = PGSIZE - (srcva - va0);
+  while(max > 0){
+    n = PGSIZE - (srcva % PGSIZE);
     if(n > max)
       n = max;
-
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
+    if((n = uresolve(pagetable, srcva, n, 0, seg, &nseg)) == 0)
+      return -1;
+    for(int i = 0; i < nseg; i++){
+      char *p = (char *) seg[i].pa;
+      for(uint64 j = 0; j < seg[i].len; j++){
+        if((*dst++ = *p++) == '\0')
+          return 0;
       }
-      --n;
-      --max;
-      p++;
-      dst++;
     }
-
-    srcva = va0 + PGSIZE;
-  }
-  if(got_null){
-    return 0;
-  } else {
-    return -1;
+    srcva += n;
+    max -= n;
   }
+  return -1;
 }
@@ -0,0 +1,559 @@
+//
+// Memory-mapped regions: mmap() and munmap().
+//
+// A process's regions live in p->vma[], at addresses that
+// grow down from just below TRAPFRAME, above the heap.
+// Nothing is mapped in the page table when a region is
+// created; vmafault() allocates each page on first touch
+// and, for a file mapping, reads it from the inode.
+// munmap() and exit() write dirty pages of MAP_SHARED
+// file mappings back to the file.
+//
+// exec() describes the program's loadable segments with
+// VMA_SEG regions in the same table, so that text and data
+// are read from the executable only when first touched.
+// A segment lies inside [0, p->sz) and its pages, once
+// faulted in, are part of the process's ordinary memory:
+// uvmfree() and uvmcopy() deal with them, and munmap()
+// leaves segments alone.
+//
+// The regions are private to their process, so no lock
+// is needed to look at them.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Return the region of p that contains va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len > 0 && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// Lowest address of any region of p; the heap
+// must stay below it.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len > 0 && (v->flags & VMA_SEG) == 0 && v->addr < base)
+      base = v->addr;
+  }
+  return base;
+}
+
+// Pick an address for a new region of len bytes: the
+// highest gap below TRAPFRAME that doesn't overlap an
+// existing region, and leaves a guard page above the heap.
+// Returns 0 if there is no such gap.
+static uint64
+vmaplace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 a;
+
+  if(len > TRAPFRAME)
+    return 0;
+  a = TRAPFRAME - len;
+ again:
+  if(a < PGROUNDUP(p->sz) + PGSIZE)
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len > 0 && a < v->addr + v->len && v->addr < a + len){
+      if(v->addr < len)
+        return 0;
+      a = v->addr - len;
+      goto again;
+    }
+  }
+  return a;
+}
+
+// Drop v's reference to its file or inode, and free the slot.
+static void
+vmaput(struct vma *v)
+{
+  if(v->f){
+    fileclose(v->f);
+  } else if(v->ip){
+    if(v->flags & VMA_SEG)
+      itextput(v->ip);
+    begin_op();
+    iput(v->ip);
+    end_op();
+  }
+  memset(v, 0, sizeof(*v));
+}
+
+// Write one page of a MAP_SHARED region back to its file,
+// at file offset off. Never extends the file. Writes are
+// split into transactions as in filewrite().
+static void
+vmawrite(struct vma *v, char *mem, uint off)
+{
+  struct inode *ip = v->f->ip;
+  int max = log_writemax();
+  int res = log_writeres(max < PGSIZE ? max : PGSIZE);
+  uint i = 0, n;
+
+  while(i < PGSIZE){
+    begin_opn(res);
+    ilock(ip);
+    n = 0;
+    if(off + i < ip->size){
+      n = ip->size - (off + i);
+      if(n > PGSIZE - i)
+        n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      if(writei(ip, 0, (uint64)mem + i, off + i, n) != n)
+        n = 0;
+    }
+    iunlock(ip);
+    end_opn(res);
+    if(n == 0)
+      break;
+    i += n;
+  }
+}
+
+// Unmap the pages of v in [a, a+len) that have been faulted
+// in, writing dirty pages of a shared file mapping back first.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 a, uint64 len)
+{
+  uint64 va, pa;
+  pte_t *pte;
+
+  for(va = a; va < a + len; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte != 0 && (*pte & PTE_SWAP)){
+      swapput(*pte);
+      *pte = 0;
+      continue;
+    }
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(v->f && (v->flags & MAP_SHARED) && (*pte & PTE_D))
+      vmawrite(v, (char*)pa, v->off + (va - v->addr));
+    *pte = 0;
+    kfree((void*)pa);
+  }
+}
+
+// Create a region of len bytes with protection prot, mapping
+// file f from offset off, or anonymous memory if flags has
+// MAP_ANON. Returns the region's address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free = 0;
+  uint64 addr;
+
+  if(len == 0 || (off % PGSIZE) != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(flags & MAP_ANON){
+    f = 0;
+    off = 0;
+  } else {
+    if(f == 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+      return -1;
+    if(!f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0){
+      free = v;
+      break;
+    }
+  }
+  if(free == 0)
+    return -1;
+
+  len = PGROUNDUP(len);
+  if((addr = vmaplace(p, len)) == 0)
+    return -1;
+
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->ip = f ? f->ip : 0;
+  free->off = off;
+  free->filesz = len;
+  return addr;
+}
+
+// Remove the mappings in [addr, addr+len). The range may
+// cover parts of several regions, or punch a hole in the
+// middle of one. Returns 0, or -1 if addr is not page-aligned
+// or a hole would need a region slot and there is none.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *spare = 0;
+  uint64 end, lo, hi, vend;
+
+  if((addr % PGSIZE) != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = addr + PGROUNDUP(len);
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 && spare == 0)
+      spare = v;
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len > 0 && (v->flags & VMA_SEG) == 0 &&
+       v->addr < addr && end < v->addr + v->len && spare == 0)
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & VMA_SEG) ||
+       end <= v->addr || v->addr + v->len <= addr)
+      continue;
+    vend = v->addr + v->len;
+    lo = addr > v->addr ? addr : v->addr;
+    hi = end < vend ? end : vend;
+    vmaunmap(p, v, lo, hi - lo);
+
+    if(lo == v->addr && hi == vend){
+      vmaput(v);
+    } else if(lo == v->addr){
+      v->off += hi - v->addr;
+      v->addr = hi;
+      v->len = v->filesz = vend - hi;
+    } else if(hi == vend){
+      v->len = v->filesz = lo - v->addr;
+    } else {
+      *spare = *v;
+      spare->addr = hi;
+      spare->len = vend - hi;
+      spare->off += hi - v->addr;
+      spare->filesz = spare->len;
+      if(spare->f)
+        filedup(spare->f);
+      v->len = v->filesz = lo - v->addr;
+    }
+  }
+  proc_flushtlb(p);
+  return 0;
+}
+
+// Free the pages in [addr, addr+len) for MADV_DONTNEED. Only
+// whole pages are freed. Heap pages read as zeros when next
+// touched, and pages of private regions and program segments
+// are paged in afresh. Returns 0, or -1 if advice is unknown
+// or the range runs outside the heap and private regions.
+int
+madvise(uint64 addr, uint64 len, int advice)
+{
+  struct proc *p = myproc();
+  uint64 a, end, va;
+
+  if(advice == MADV_NORMAL)
+    return 0;
+  if(advice != MADV_DONTNEED || addr + len < addr || addr + len > TRAPFRAME)
+    return -1;
+  a = PGROUNDUP(addr);
+  end = PGROUNDDOWN(addr + len);
+  if(a >= end)
+    return 0;
+
+  // MAP_SHARED pages go back to their file only at munmap().
+  for(va = a; va < end; va += PGSIZE){
+    if(va >= PGROUNDUP(p->sz) && vmafind(p, va) == 0)
+      return -1;
+    if(vmashared(p, va))
+      return -1;
+  }
+  if(uvmdiscard(p->pagetable, a, (end - a) / PGSIZE) < 0)
+    return -1;
+  proc_flushtlb(p);
+  return 0;
+}
+
+// Remove all of the current process's regions, and forget
+// its program segments. Called by exit() and exec().
+void
+vmaclear(void)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    if(v->flags & VMA_SEG)
+      vmaput(v);
+    else
+      munmap(v->addr, v->len);
+  }
+}
+
+// Give the current process the n program segments in seg,
+// which exec() has built for its new image. The process
+// must have no regions.
+void
+vmasetsegs(struct vma *seg, int n)
+{
+  struct proc *p = myproc();
+
+  if(n > NVMA)
+    panic("vmasetsegs");
+  for(int i = 0; i < n; i++){
+    if(p->vma[i].len != 0)
+      panic("vmasetsegs: in use");
+    p->vma[i] = seg[i];
+  }
+}
+
+// Drop the inode references held by n program segments
+// that exec() built but didn't install.
+void
+vmaputsegs(struct vma *seg, int n)
+{
+  for(int i = 0; i < n; i++)
+    vmaput(&seg[i]);
+}
+
+// Give child np a copy of p's regions and of every page of
+// them that p has faulted in; np pages in the rest itself.
+// A MAP_SHARED region is shared with the file, not with np.
+// Returns 0 on success, -1 on failure, leaving np with
+// no regions.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  uint64 va, pa;
+  pte_t *pte, *npte;
+  char *mem;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->len == 0)
+      continue;
+    np->vma[i] = *v;
+    if(v->flags & VMA_SEG)
+      continue;
+    for(va = v->addr; va < v->addr + v->len; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte != 0 && (*pte & PTE_SWAP)){
+        // share the slot; each swaps in its own copy.
+        if((npte = walk(np->pagetable, va, 1)) == 0)
+          goto err;
+        swapdup(*pte);
+        *npte = *pte;
+        continue;
+      }
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      if((*pte & PTE_W) == 0){
+        // no one writes a read-only page; share it.
+        kdup((void*)pa);
+        mem = (char*)pa;
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+      }
+      // the child's copy starts clean; p writes back its own.
+      if(mappages(np->pagetable, va, PGSIZE, (uint64)mem,
+                  PTE_FLAGS(*pte) & ~PTE_D) != 0){
+        kfree(mem);
+        goto err;
+      }
+    }
+  }
+
+  for(i = 0; i < NVMA; i++){
+    if(np->vma[i].f)
+      filedup(np->vma[i].f);
+    else if(np->vma[i].ip)
+      idup(np->vma[i].ip);
+    if(np->vma[i].ip && (np->vma[i].flags & VMA_SEG))
+      itextdup(np->vma[i].ip);
+  }
+  return 0;
+
+ err:
+  for(i = 0; i < NVMA; i++){
+    v = &np->vma[i];
+    if(v->len > 0 && (v->flags & VMA_SEG) == 0)
+      vmaunmap(np, v, v->addr, v->len);
+    memset(v, 0, sizeof(*v));
+  }
+  return -1;
+}
+
+// Return a page holding v's contents at va: zeroes, then
+// the bytes backed by the inode, if any. A read-only page of
+// an inode comes from the page cache when possible, shared
+// with other processes, and is added to it otherwise.
+// Returns 0 if out of memory or the inode can't be read.
+static char*
+vmapage(struct vma *v, uint64 va)
+{
+  struct inode *ip = v->ip;
+  char *mem;
+  uint n, off;
+  int locked, r, share;
+
+  n = 0;
+  if(va - v->addr < v->filesz)
+    n = v->filesz - (va - v->addr);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  off = v->off + (va - v->addr);
+  share = ip != 0 && n > 0 && (v->prot & PROT_WRITE) == 0;
+
+  if(ip == 0 || n == 0)
+    return kalloc_zeroed();
+
+  // the fault may come from a copyout() inside readi()
+  // or writei() on this same inode.
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  if(share && (mem = pcacheget(ip, off, n)) != 0)
+    goto out;
+  if((mem = kalloc_zeroed()) == 0)
+    goto out;
+  // a file mapping past end of file reads as zero,
+  // but a segment must be all there.
+  r = readi(ip, 0, (uint64)mem, off, n);
+  if(r < 0 || ((v->flags & VMA_SEG) && r != n)){
+    kfree(mem);
+    mem = 0;
+    goto out;
+  }
+  if(share && r == n)
+    pcacheput(ip, off, n, mem);
+ out:
+  if(!locked)
+    iunlock(ip);
+  return mem;
+}
+
+// Handle a fault at va in pagetable, for access (PROT_READ,
+// PROT_WRITE or PROT_EXEC), by reading va back from swap, by
+// paging it in from the current process's region, if it has
+// one that allows the access, or with a zeroed page if it is
+// a heap page that madvise() freed.
+// Returns 0 if va is now mapped, -1 if the fault is a real one.
+int
+vmafault(pagetable_t pagetable, uint64 va, int access)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  // a page of any kind that swapout() wrote to disk.
+  pte = walk(pagetable, va, 0);
+  if(pte != 0 && (*pte & PTE_SWAP))
+    return swapin(pte);
+
+  if((v = vmafind(p, va)) == 0 && va < p->sz && (pte == 0 || *pte == 0) &&
+     access != PROT_EXEC){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_U|PTE_R|PTE_W) != 0){
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  if(v == 0 || (v->prot & access) == 0)
+    return -1;
+  // sbrk() may have shrunk the process below a segment's end.
+  if((v->flags & VMA_SEG) && va >= p->sz)
+    return -1;
+  if(pte != 0 && (*pte & PTE_V))
+    return -1;
+
+  if((mem = vmapage(v, va)) == 0)
+    return -1;
+
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Is va in a MAP_SHARED region of p? Their pages stay in
+// memory, for munmap() to write back.
+int
+vmashared(struct proc *p, uint64 va)
+{
+  struct vma *v = vmafind(p, va);
+
+  return v != 0 && (v->flags & MAP_SHARED);
+}
+
+// Page in any not-yet-touched region pages in [va, va+len)
+// that a kernel copy is about to access, so that the copy
+// doesn't fault while it holds a buffer lock. Errors are
+// left for the copy itself to report.
+void
+vmafaultin(uint64 va, uint64 len, int access)
+{
+  struct proc *p = myproc();
+  uint64 a;
+  pte_t *pte;
+
+  if(len == 0 || va >= MAXVA)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE){
+    if(vmafind(p, a) == 0)
+      continue;
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      vmafault(p->pagetable, a, access);
+  }
+}
@@ -18,13 +18,15 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks | swap ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = FSSIZE / LOGFRAC;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
+int nswapblocks = NSWAPPG * (4096 / BSIZE);  // blocks in the swap area
+int extents;  // give files the extent layout
 
 int fsfd;
 struct superblock sb;
@@ -77,8 +79,31 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(nlog < LOGSIZE)
+    nlog = LOGSIZE;
+  if(nlog > LOGMAX + 1)
+    nlog = LOGMAX + 1;
+  for(; argc >= 2 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-l") == 0 && argc >= 3){
+      nlog = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else if(strcmp(argv[1], "-e") == 0){
+      extents = 1;
+    } else {
+      argc = 0;
+      break;
+    }
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  // the kernel wants room for two FS system calls, and
+  // the header can't name more than LOGMAX blocks.
+  if(nlog < 2*MAXOPBLOCKS + 1 || nlog > LOGMAX + 1){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n",
+            2*MAXOPBLOCKS + 1, (int)LOGMAX + 1);
     exit(1);
   }
 
@@ -101,13 +126,15 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(NSWAPPG);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d swap %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, nswapblocks);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < FSSIZE + nswapblocks; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -148,6 +175,11 @@ main(int argc, char *argv[])
       shortname += 1;
 
     inum = ialloc(T_FILE);
+    if(extents){
+      rinode(inum, &din);
+      din.flags = xint(I_EXTENT);
+      winode(inum, &din);
+    }
 
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
@@ -249,6 +281,88 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the address of block fbn of I_EXTENT inode din,
+// allocating it if fbn is just past the last block.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent x[NXEXTENT], *e, *last;
+  uint first;
+  int i;
+
+  if(XBLOCK(din->addrs))
+    rsect(xint(XBLOCK(din->addrs)), x);
+  last = 0;
+  first = 0;
+  for(i = 0; i < NEXTENT + NXEXTENT; i++){
+    if(i == NEXTENT && XBLOCK(din->addrs) == 0)
+      break;
+    e = i < NEXTENT ? (struct extent*)din->addrs + i : x + (i - NEXTENT);
+    if(xint(e->len) == 0)
+      break;
+    if(fbn - first < xint(e->len))
+      return xint(e->start) + (fbn - first);
+    first += xint(e->len);
+    last = e;
+  }
+  assert(fbn == first);
+
+  if(last && xint(last->start) + xint(last->len) == freeblock){
+    last->len = xint(xint(last->len) + 1);
+  } else {
+    assert(i < NEXTENT + NXEXTENT);
+    if(i == NEXTENT && XBLOCK(din->addrs) == 0){
+      XBLOCK(din->addrs) = xint(freeblock++);
+      bzero(x, sizeof(x));
+    }
+    e = i < NEXTENT ? (struct extent*)din->addrs + i : x + (i - NEXTENT);
+    e->start = xint(freeblock);
+    e->len = xint(1);
+  }
+  if(XBLOCK(din->addrs))
+    wsect(xint(XBLOCK(din->addrs)), x);
+  return freeblock++;
+}
+
+// Return the address of block fbn of inode din, allocating
+// it, and the index blocks over it, if it has none.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, first, n;
+  int level;
+
+  if(xint(din->flags) & I_EXTENT)
+    return emap(din, fbn);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(freeblock++);
+    return xint(din->addrs[fbn]);
+  }
+  first = NDIRECT;
+  n = NINDIRECT;
+  for(level = 1; fbn - first >= n; level++){
+    assert(level < NLEVEL);
+    first += n;
+    n *= NINDIRECT;
+  }
+  if(xint(din->addrs[NDIRECT + level - 1]) == 0)
+    din->addrs[NDIRECT + level - 1] = xint(freeblock++);
+  addr = xint(din->addrs[NDIRECT + level - 1]);
+  while(level-- > 0){
+    n /= NINDIRECT;
+    rsect(addr, (char*)indirect);
+    if(indirect[(fbn - first) / n] == 0){
+      indirect[(fbn - first) / n] = xint(freeblock++);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[(fbn - first) / n]);
+    first += (fbn - first) / n * n;
+  }
+  return addr;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +370,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -265,22 +378,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
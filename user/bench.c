@@ -0,0 +1,888 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/spawn.h"
+#include "kernel/memstat.h"
+
+//
+// Micro-benchmarks for the kernel, in the manner of lmbench:
+// system calls, process creation, context switches, pipes,
+// file creation and file I/O. Check changes to proc.c, vm.c,
+// pipe.c and fs.c against them.
+//
+// Times come from the time CSR (rdtime), which start() lets
+// user mode read, and are reported per operation and per
+// second.
+//
+// bench        runs every benchmark
+// bench name   runs just the named one
+//
+
+#define MB (1024*1024)
+
+// rdtime counts at TIMEBASE Hz on qemu's virt machine.
+#define TIMEBASE 10000000
+
+uint64
+now(void)
+{
+  return r_time();
+}
+
+// report count units of work done in t time units.
+void
+report(char *s, char *unit, uint64 count, uint64 t)
+{
+  uint64 ns = t * (1000000000 / TIMEBASE);
+
+  if(ns == 0)
+    ns = 1;
+  printf("%s: %l %s in %l us, %l ns each, %l %s/s\n", s, count, unit,
+         ns / 1000, count ? ns / count : 0, count * 1000000000 / ns, unit);
+}
+
+// report the disk requests between two memstat()s, how deep
+// the queue was, and, if kb isn't 0, how many it took per MB.
+void
+reportdisk(char *s, struct memstat *ms0, struct memstat *ms1, uint64 kb)
+{
+  uint64 n = ms1->diskreqs - ms0->diskreqs;
+  uint64 d = ms1->diskdepthsum - ms0->diskdepthsum;
+
+  printf("%s: %l disk requests, %l.%l in flight on average", s, n,
+         n ? d / n : 0, n ? d * 10 / n % 10 : 0);
+  if(kb)
+    printf(", %l per MB", n * 1024 / kb);
+  printf("\n");
+}
+
+// report the blocks FS system calls logged between two
+// memstat()s, and how many of them were already in the log.
+void
+reportlog(char *s, struct memstat *ms0, struct memstat *ms1)
+{
+  uint64 w = ms1->logwrites - ms0->logwrites;
+  uint64 a = ms1->logabsorbs - ms0->logabsorbs;
+
+  printf("%s: %l log block writes, %l absorbed (%l%%)\n", s, w, a,
+         w ? a * 100 / w : 0);
+}
+
+// grow the heap by 16MB, touch every page, and give it back.
+// sbrk() allocates and zeroes the pages itself, so the touches
+// don't fault; this measures allocate-and-zero. with NHUGEPG > 0
+// most of it is backed by 2MB megapages.
+void
+sbrkbench(char *s)
+{
+  enum { SZ = 16*MB, ROUNDS = 8 };
+  uint64 pages = 0;
+  uint64 t0, t1;
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    char *a = sbrk(SZ);
+    if(a == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(char *p = a; p < a + SZ; p += PGSIZE)
+      *p = 1;
+    pages += SZ / PGSIZE;
+    if(sbrk(-SZ) == (char*)-1){
+      printf("%s: sbrk shrink failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = now();
+  report(s, "pages", pages, t1 - t0);
+}
+
+// map 16MB of anonymous memory, touch every page, and unmap it.
+// mmap() allocates nothing, so each touch takes a page fault.
+void
+faultbench(char *s)
+{
+  enum { SZ = 16*MB, ROUNDS = 8 };
+  uint64 pages = 0;
+  uint64 t0, t1;
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    char *a = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if(a == (char*)-1){
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    for(char *p = a; p < a + SZ; p += PGSIZE)
+      *p = 1;
+    pages += SZ / PGSIZE;
+    if(munmap(a, SZ) < 0){
+      printf("%s: munmap failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = now();
+  report(s, "faults", pages, t1 - t0);
+}
+
+// fork a process with an 8MB heap; each fork copies the image.
+void
+forkbench(char *s)
+{
+  enum { SZ = 8*MB, ROUNDS = 16 };
+  uint64 t0, t1;
+  int pid;
+  char *a;
+
+  a = sbrk(SZ);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(char *p = a; p < a + SZ; p += PGSIZE)
+    *p = 1;
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  t1 = now();
+  sbrk(-SZ);
+  report(s, "MB copied", (uint64)ROUNDS * SZ / MB, t1 - t0);
+}
+
+// fork a child that exits at once, and wait for it: the
+// cost of making and tearing down a small process.
+void
+procbench(char *s)
+{
+  enum { ROUNDS = 200 };
+  uint64 t0, t1;
+  int pid;
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  t1 = now();
+  report(s, "forks", ROUNDS, t1 - t0);
+}
+
+// fork, exec prog, and wait, ROUNDS times. the child's
+// input and output are the write end of a pipe with no
+// reader, so reads fail at once (sh exits) and writes go
+// nowhere.
+void
+execone(char *s, char *prog, char **argv)
+{
+  enum { ROUNDS = 20 };
+  uint64 t0, t1;
+  int pid, fds[2];
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      close(0);
+      dup(fds[1]);
+      close(1);
+      dup(fds[1]);
+      close(fds[1]);
+      exec(prog, argv);
+      printf("%s: exec %s failed\n", s, prog);
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    wait(0);
+  }
+  t1 = now();
+  report(prog, "execs", ROUNDS, t1 - t0);
+}
+
+void
+execbench(char *s)
+{
+  char *usertests[] = { "usertests", "-?", 0 };
+  char *sh[] = { "sh", 0 };
+
+  execone(s, "usertests", usertests);
+  execone(s, "sh", sh);
+}
+
+// start a program from a process with an 8MB heap, with
+// fork() and exec() and then with spawn(), which doesn't
+// copy the heap. output goes to a pipe, as in execone().
+void
+spawnbench(char *s)
+{
+  enum { SZ = 8*MB, ROUNDS = 20 };
+  char *argv[] = { "echo", 0 };
+  struct spawnact act[3];
+  uint64 t0, t1;
+  int fds[2];
+  char *a;
+
+  a = sbrk(SZ);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(char *p = a; p < a + SZ; p += PGSIZE)
+    *p = 1;
+
+  execone(s, "echo", argv);
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    act[0] = (struct spawnact){ SPAWN_DUP, 1, fds[1], 0 };
+    act[1] = (struct spawnact){ SPAWN_CLOSE, fds[0], 0, 0 };
+    act[2] = (struct spawnact){ SPAWN_CLOSE, fds[1], 0, 0 };
+    if(spawn("echo", argv, act, 3) < 0){
+      printf("%s: spawn failed\n", s);
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    wait(0);
+  }
+  t1 = now();
+  report(s, "spawns", ROUNDS, t1 - t0);
+}
+
+// a null system call; each one is a round trip through
+// the trampoline.
+void
+syscallbench(char *s)
+{
+  enum { N = 100000 };
+  uint64 t0, t1;
+
+  t0 = now();
+  for(int i = 0; i < N; i++)
+    getpid();
+  t1 = now();
+  report(s, "calls", N, t1 - t0);
+}
+
+// two processes pass a byte back and forth through a pair
+// of pipes; each round trip is two context switches, and
+// twice the pipe latency.
+void
+ctxswbench(char *s)
+{
+  enum { N = 10000 };
+  uint64 t0, t1;
+  int pid, a[2], b[2];
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < N; i++){
+      if(read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  t0 = now();
+  for(int i = 0; i < N; i++){
+    if(write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1){
+      printf("%s: pipe i/o failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = now();
+  wait(0);
+  report(s, "round trips", N, t1 - t0);
+}
+
+// stream SZ bytes from a child through a pipe, chunk bytes
+// per read() and write().
+char pipebuf[64*1024];
+
+void
+pipeone(char *s, int chunk)
+{
+  enum { SZ = 4*MB };
+  uint64 t0, t1, total = 0;
+  int pid, n, fds[2];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int i = 0; i < SZ; i += chunk)
+      if(write(fds[1], pipebuf, chunk) != chunk)
+        exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  t0 = now();
+  while((n = read(fds[0], pipebuf, chunk)) > 0)
+    total += n;
+  t1 = now();
+  close(fds[0]);
+  wait(0);
+  if(total != SZ){
+    printf("%s: read %l bytes of %d\n", s, total, SZ);
+    exit(1);
+  }
+  printf("%d-byte chunks: ", chunk);
+  report(s, "KB", SZ / 1024, t1 - t0);
+}
+
+void
+pipebench(char *s)
+{
+  pipeone(s, 512);
+  pipeone(s, 4096);
+  pipeone(s, sizeof(pipebuf));
+}
+
+// create N empty files, then unlink them.
+void
+createbench(char *s)
+{
+  enum { N = 100 };
+  struct memstat ms0, ms1;
+  char name[8];
+  uint64 t0, t1;
+  int fd;
+
+  memstat(&ms0, 0, 0);
+  name[0] = 'b';
+  name[1] = 'c';
+  name[4] = 0;
+  t0 = now();
+  for(int i = 0; i < N; i++){
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = now();
+  report(s, "files", N, t1 - t0);
+
+  t0 = now();
+  for(int i = 0; i < N; i++){
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  t1 = now();
+  report("unlink", "files", N, t1 - t0);
+  memstat(&ms1, 0, 0);
+  reportlog(s, &ms0, &ms1);
+  reportdisk(s, &ms0, &ms1, 0);
+}
+
+// large reads and writes: write a 192KB file in 32KB
+// chunks, then read it back whole, ROUNDS times over. most
+// of the time goes to copying between the buffer cache and
+// user memory.
+char rwbuf[192*1024];
+
+void
+rwbench(char *s)
+{
+  enum { SZ = sizeof(rwbuf), CHUNK = 32*1024, ROUNDS = 16 };
+  struct memstat ms0, ms1;
+  uint64 t0, t1;
+  int fd;
+
+  memset(rwbuf, 'x', SZ);
+  unlink("benchrw");
+  fd = open("benchrw", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memstat(&ms0, 0, 0);
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    for(int off = 0; off < SZ; off += CHUNK){
+      if(write(fd, rwbuf + off, CHUNK) != CHUNK){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+    fd = open("benchrw", O_WRONLY);
+  }
+  t1 = now();
+  close(fd);
+  memstat(&ms1, 0, 0);
+  report("write", "KB", (uint64)ROUNDS * SZ / 1024, t1 - t0);
+  reportdisk("write", &ms0, &ms1, (uint64)ROUNDS * SZ / 1024);
+
+  t0 = now();
+  for(int r = 0; r < ROUNDS; r++){
+    fd = open("benchrw", O_RDONLY);
+    if(fd < 0 || read(fd, rwbuf, SZ) != SZ){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = now();
+  report("read", "KB", (uint64)ROUNDS * SZ / 1024, t1 - t0);
+  unlink("benchrw");
+}
+
+// write 1MB files, in 64KB write()s; the log splits each
+// write() into as few transactions as fit.
+void
+bigwritebench(char *s)
+{
+  enum { CHUNK = 64*1024, FILESZ = MB, NF = 2 };
+  struct memstat ms0, ms1;
+  char name[8];
+  uint64 t0, t1, ops, commits;
+  int fd;
+
+  memset(rwbuf, 'x', CHUNK);
+  name[0] = 'b';
+  name[1] = 'w';
+  name[3] = 0;
+  memstat(&ms0, 0, 0);
+  t0 = now();
+  for(int i = 0; i < NF; i++){
+    name[2] = '0' + i;
+    unlink(name);
+    fd = open(name, O_CREATE|O_WRONLY);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    for(int off = 0; off < FILESZ; off += CHUNK){
+      if(write(fd, rwbuf, CHUNK) != CHUNK){
+        printf("%s: write %s failed\n", s, name);
+        exit(1);
+      }
+    }
+    if(fsync(fd) < 0){
+      printf("%s: fsync %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = now();
+  memstat(&ms1, 0, 0);
+  for(int i = 0; i < NF; i++){
+    name[2] = '0' + i;
+    unlink(name);
+  }
+  report(s, "KB", NF * FILESZ / 1024, t1 - t0);
+  ops = ms1.logops - ms0.logops;
+  commits = ms1.logcommits - ms0.logcommits;
+  printf("%s: %l transactions, %l commits, %l KB per transaction\n", s,
+         ops, commits, ops ? NF * FILESZ / 1024 / ops : 0);
+  reportlog(s, &ms0, &ms1);
+  reportdisk(s, &ms0, &ms1, NF * FILESZ / 1024);
+}
+
+// sequential reads of a file that isn't cached, 4KB at a
+// time as cat would, so that the time is mostly the disk's.
+// read-ahead keeps the disk busy while the reader copies.
+void
+seqreadbench(char *s)
+{
+  enum { SZ = sizeof(rwbuf), CHUNK = 4096, ROUNDS = 4 };
+  struct memstat ms0, ms1;
+  uint64 t, t0;
+  int fd, n;
+
+  memset(rwbuf, 'x', SZ);
+  unlink("benchseq");
+  fd = open("benchseq", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, rwbuf, SZ) != SZ){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memstat(&ms0, 0, 0);
+  t = 0;
+  for(int r = 0; r < ROUNDS; r++){
+    dropcache();
+    t0 = now();
+    fd = open("benchseq", O_RDONLY);
+    if(fd < 0){
+      printf("%s: open failed\n", s);
+      exit(1);
+    }
+    while((n = read(fd, rwbuf, CHUNK)) > 0)
+      ;
+    close(fd);
+    t += now() - t0;
+  }
+  memstat(&ms1, 0, 0);
+  unlink("benchseq");
+  report(s, "KB", (uint64)ROUNDS * SZ / 1024, t);
+  printf("%s: %l blocks read ahead, %l misses\n", s,
+         ms1.bufaheads - ms0.bufaheads, ms1.bufmisses - ms0.bufmisses);
+  reportdisk(s, &ms0, &ms1, (uint64)ROUNDS * SZ / 1024);
+}
+
+// NCHILD processes at once each create, write, read back
+// and unlink small files in a directory of their own, so
+// that they share nothing but the buffer cache and the log.
+// reports how often a buffer cache lock was already held.
+void
+fsparbench(char *s)
+{
+  enum { NCHILD = 4, N = 50 };
+  struct memstat ms0, ms1;
+  char dir[8], name[8], c = 0;
+  uint64 t0, t1;
+  int fd, xstatus, ok = 1;
+
+  memstat(&ms0, 0, 0);
+  t0 = now();
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid != 0)
+      continue;
+    dir[0] = 'p';
+    dir[1] = '0' + i;
+    dir[2] = 0;
+    if(mkdir(dir) < 0 || chdir(dir) < 0)
+      exit(1);
+    name[0] = 'f';
+    name[3] = 0;
+    for(int j = 0; j < N; j++){
+      name[1] = '0' + j / 10;
+      name[2] = '0' + j % 10;
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0 || write(fd, rwbuf, 1024) != 1024)
+        exit(1);
+      close(fd);
+      fd = open(name, O_RDONLY);
+      if(fd < 0 || read(fd, &c, 1) != 1)
+        exit(1);
+      close(fd);
+      if(unlink(name) < 0)
+        exit(1);
+    }
+    chdir("..");
+    unlink(dir);
+    exit(0);
+  }
+  for(int i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    ok &= xstatus == 0;
+  }
+  t1 = now();
+  memstat(&ms1, 0, 0);
+  if(!ok){
+    printf("%s: a child failed\n", s);
+    exit(1);
+  }
+  report(s, "files", NCHILD * N, t1 - t0);
+  printf("%s: bcache locks taken %l, waited %l\n", s,
+         ms1.bufacquires - ms0.bufacquires, ms1.bufwaits - ms0.bufwaits);
+}
+
+// write and read back a 1MB file in the classic layout and
+// in extents (O_EXTENT), after leaving the free space full
+// of small holes, as deleting every other small file does.
+// classic files fill the holes; extents skip them, so a cold
+// read of one takes fewer, longer disk requests.
+void
+layoutone(char *s, char *rs, int omode)
+{
+  enum { CHUNK = 64*1024, SZ = MB, NHOLE = 64, HOLESZ = 4*BSIZE };
+  struct memstat ms0, ms1;
+  char name[8];
+  uint64 t0, t1;
+  int fd;
+
+  memset(rwbuf, 'x', CHUNK);
+  name[0] = 'l';
+  name[1] = 'h';
+  name[4] = 0;
+  for(int i = 0; i < 2*NHOLE; i++){
+    name[2] = 'a' + i / 26;
+    name[3] = 'a' + i % 26;
+    fd = open(name, O_CREATE|O_WRONLY);
+    if(fd < 0 || write(fd, rwbuf, HOLESZ) != HOLESZ){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(int i = 0; i < 2*NHOLE; i += 2){
+    name[2] = 'a' + i / 26;
+    name[3] = 'a' + i % 26;
+    unlink(name);
+  }
+
+  unlink("benchlay");
+  memstat(&ms0, 0, 0);
+  t0 = now();
+  fd = open("benchlay", O_CREATE|O_WRONLY|omode);
+  for(int off = 0; off < SZ; off += CHUNK){
+    if(fd < 0 || write(fd, rwbuf, CHUNK) != CHUNK){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  fsync(fd);
+  close(fd);
+  t1 = now();
+  memstat(&ms1, 0, 0);
+  report(s, "KB", SZ / 1024, t1 - t0);
+  reportdisk(s, &ms0, &ms1, SZ / 1024);
+
+  dropcache();
+  memstat(&ms0, 0, 0);
+  t0 = now();
+  fd = open("benchlay", O_RDONLY);
+  while(read(fd, rwbuf, CHUNK) > 0)
+    ;
+  close(fd);
+  t1 = now();
+  memstat(&ms1, 0, 0);
+  report(rs, "KB", SZ / 1024, t1 - t0);
+  reportdisk(rs, &ms0, &ms1, SZ / 1024);
+
+  unlink("benchlay");
+  for(int i = 1; i < 2*NHOLE; i += 2){
+    name[2] = 'a' + i / 26;
+    name[3] = 'a' + i % 26;
+    unlink(name);
+  }
+}
+
+void
+layoutbench(char *s)
+{
+  layoutone("classic write", "classic read", 0);
+  layoutone("extent write", "extent read", O_EXTENT);
+}
+
+// a simple generator for benchmarks that need random numbers.
+static uint64 seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return seed >> 33;
+}
+
+// 1KB reads, then writes, at random block-aligned offsets
+// of a 192KB file.
+void
+randrwbench(char *s)
+{
+  enum { SZ = sizeof(rwbuf), BLK = 1024, N = 2000 };
+  uint64 t0, t1;
+  int fd;
+
+  unlink("benchrand");
+  fd = open("benchrand", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, rwbuf, SZ) != SZ){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  t0 = now();
+  for(int i = 0; i < N; i++){
+    if(lseek(fd, (rnd() % (SZ / BLK)) * BLK, SEEK_SET) < 0 ||
+       read(fd, rwbuf, BLK) != BLK){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = now();
+  report("randread", "KB", N * BLK / 1024, t1 - t0);
+
+  t0 = now();
+  for(int i = 0; i < N; i++){
+    if(lseek(fd, (rnd() % (SZ / BLK)) * BLK, SEEK_SET) < 0 ||
+       write(fd, rwbuf, BLK) != BLK){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = now();
+  report("randwrite", "KB", N * BLK / 1024, t1 - t0);
+  close(fd);
+  unlink("benchrand");
+}
+
+// random malloc() and free() of mixed sizes: mostly small
+// blocks, some of a few KB, a few large. reports the heap at
+// its peak against the bytes that were live at the time.
+void
+mallocbench(char *s)
+{
+  enum { NSLOT = 1024, N = 200000 };
+  static char *slot[NSLOT];
+  static uint size[NSLOT];
+  uint64 live = 0, peaklive = 0, heap, peakheap = 0;
+  char *start = sbrk(0);
+  uint64 t0, t1;
+  int j;
+  uint r, n;
+
+  t0 = now();
+  for(int i = 0; i < N; i++){
+    r = rnd();
+    j = r % NSLOT;
+    if(slot[j]){
+      free(slot[j]);
+      slot[j] = 0;
+      live -= size[j];
+      continue;
+    }
+    r = rnd();
+    if(r % 100 < 80)
+      n = 8 + r % 256;
+    else if(r % 100 < 97)
+      n = 256 + r % 4096;
+    else
+      n = 4096 + r % (32*1024);
+    if((slot[j] = malloc(n)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+    slot[j][0] = slot[j][n-1] = 1;
+    size[j] = n;
+    live += n;
+    if(live > peaklive)
+      peaklive = live;
+    heap = sbrk(0) - start;
+    if(heap > peakheap)
+      peakheap = heap;
+  }
+  t1 = now();
+  report(s, "ops", N, t1 - t0);
+  printf("%s: peak heap %lKB, peak live %lKB\n", s, peakheap / 1024,
+         peaklive / 1024);
+}
+
+struct bench {
+  void (*f)(char *);
+  char *s;
+} benches[] = {
+  {syscallbench, "syscall"},
+  {procbench, "proc"},
+  {forkbench, "fork"},
+  {execbench, "exec"},
+  {spawnbench, "spawn"},
+  {ctxswbench, "ctxsw"},
+  {pipebench, "pipe"},
+  {createbench, "create"},
+  {fsparbench, "fspar"},
+  {rwbench, "rw"},
+  {bigwritebench, "bigwrite"},
+  {seqreadbench, "seqread"},
+  {layoutbench, "layout"},
+  {randrwbench, "randrw"},
+  {sbrkbench, "sbrk"},
+  {faultbench, "fault"},
+  {mallocbench, "malloc"},
+  { 0, 0},
+};
+
+// run each benchmark in its own process so that one
+// bench's heap doesn't skew the next.
+int
+run(void f(char *), char *s)
+{
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("bench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    f(s);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    printf("%s: FAILED\n", s);
+  return xstatus == 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *justone = 0;
+  int ok = 1;
+
+  if(argc == 2 && argv[1][0] != '-'){
+    justone = argv[1];
+  } else if(argc > 1){
+    printf("Usage: bench [name]\n");
+    exit(1);
+  }
+
+  for(struct bench *b = benches; b->s != 0; b++){
+    if(justone == 0 || strcmp(b->s, justone) == 0)
+      ok &= run(b->f, b->s);
+  }
+  exit(ok ? 0 : 1);
+}
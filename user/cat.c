@@ -4,11 +4,19 @@
 
 char buf[512];
 
+// copy fd to the standard output: with splice() when one
+// of them is a pipe and the other a file, so the data isn't
+// copied through buf, else with read() and write().
 void
 cat(int fd)
 {
   int n;
 
+  while((n = splice(fd, 1, 64*1024)) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
@@ -2,30 +2,53 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
 char buf[1024];
 int match(char*, char*);
 
+// print the lines of [p, end) that match; a last line
+// with no newline is not looked at.
+char*
+grepbuf(char *pattern, char *p, char *end)
+{
+  char *q;
+
+  for(q = p; q < end; q++){
+    if(*q != '\n')
+      continue;
+    *q = 0;
+    if(match(pattern, p)){
+      *q = '\n';
+      write(1, p, q+1 - p);
+    }
+    p = q+1;
+  }
+  return p;
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m;
-  char *p, *q;
+  char *p;
+  struct stat st;
+
+  // scan a plain file in place. the mapping is private
+  // and writable, so that lines can be terminated.
+  if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0 &&
+     (p = mmap(0, st.size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) != (char*)-1){
+    grepbuf(pattern, p, p + st.size);
+    munmap(p, st.size);
+    return;
+  }
 
   m = 0;
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
     buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
+    p = grepbuf(pattern, buf, buf + m);
     if(m > 0){
       m -= p - buf;
       memmove(buf, p, m);
@@ -0,0 +1,54 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+//
+// memstat: print free memory and each process's resident size.
+// sizes are in KB.
+//
+
+#define KB(pages) ((pages) * 4)
+
+char *states[] = { "unused", "used", "sleep", "runble", "run", "zombie" };
+
+struct procmem pm[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat ms;
+  int n;
+
+  if(argc > 1){
+    fprintf(2, "usage: memstat\n");
+    exit(1);
+  }
+  if((n = memstat(&ms, pm, NPROC)) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+
+  printf("total %lKB free %lKB (zeroed %lKB) shared %lKB cached %lKB\n",
+         KB(ms.total), KB(ms.free), KB(ms.zeroed), KB(ms.shared), KB(ms.cached));
+  printf("megapages %l free of %l\n", ms.megafree, ms.megatotal);
+  printf("allocs %l failed %l\n", ms.allocs, ms.fails);
+  printf("swap %lKB used of %lKB, %l pages out, %l in\n",
+         KB(ms.swapused), KB(ms.swaptotal), ms.swapouts, ms.swapins);
+  printf("bcache %l blocks of %l, %l hits %l misses %l read ahead, locks taken %l, waited %l\n",
+         ms.bufs, ms.bufmax, ms.bufhits, ms.bufmisses, ms.bufaheads,
+         ms.bufacquires, ms.bufwaits);
+  printf("disk %l requests, %l.%l in flight on average, at most %l\n", ms.diskreqs,
+         ms.diskreqs ? ms.diskdepthsum / ms.diskreqs : 0,
+         ms.diskreqs ? ms.diskdepthsum * 10 / ms.diskreqs % 10 : 0, ms.diskmaxdepth);
+  printf("log %l FS calls in %l commits, %l block writes, %l absorbed\n",
+         ms.logops, ms.logcommits, ms.logwrites, ms.logabsorbs);
+
+  printf("pid\tstate\tsize\trss\tshared\tname\n");
+  for(int i = 0; i < n; i++){
+    printf("%d\t%s\t%lKB\t%lKB\t%lKB\t%s\n", pm[i].pid,
+           pm[i].state >= 0 && pm[i].state < 6 ? states[pm[i].state] : "???",
+           pm[i].sz / 1024, KB(pm[i].rss), KB(pm[i].shared), pm[i].name);
+  }
+  exit(0);
+}
@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -131,6 +133,75 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// If cmd is a program run with at most three redirections,
+// return its execcmd, else 0.
+struct execcmd*
+simplecmd(struct cmd *cmd)
+{
+  int n = 0;
+
+  while(cmd->type == REDIR && n++ < 3)
+    cmd = ((struct redircmd*)cmd)->cmd;
+  if(cmd->type != EXEC || ((struct execcmd*)cmd)->argv[0] == 0)
+    return 0;
+  return (struct execcmd*)cmd;
+}
+
+// Run cmd with spawn(), which doesn't copy the shell's
+// memory, if it is a simple command or a pipeline of them.
+// Returns the number of processes started, or -1 if cmd
+// needs a fork()ed shell to run it.
+int
+spawncmd(struct cmd *cmd)
+{
+  struct spawnact act[NSPAWNACT], *a;
+  struct cmd *c, *stage;
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+  int p[2], in, n, last;
+
+  for(c = cmd; c->type == PIPE; c = ((struct pipecmd*)c)->right)
+    if(simplecmd(((struct pipecmd*)c)->left) == 0)
+      return -1;
+  if(simplecmd(c) == 0)
+    return -1;
+
+  in = -1;
+  n = 0;
+  for(c = cmd; ; c = ((struct pipecmd*)c)->right){
+    last = c->type != PIPE;
+    stage = last ? c : ((struct pipecmd*)c)->left;
+    a = act;
+    if(in >= 0){
+      *a++ = (struct spawnact){ SPAWN_DUP, 0, in, 0 };
+      *a++ = (struct spawnact){ SPAWN_CLOSE, in, 0, 0 };
+    }
+    if(!last){
+      if(pipe(p) < 0)
+        panic("pipe");
+      *a++ = (struct spawnact){ SPAWN_DUP, 1, p[1], 0 };
+      *a++ = (struct spawnact){ SPAWN_CLOSE, p[0], 0, 0 };
+      *a++ = (struct spawnact){ SPAWN_CLOSE, p[1], 0, 0 };
+    }
+    for(; stage->type == REDIR; stage = rcmd->cmd){
+      rcmd = (struct redircmd*)stage;
+      *a++ = (struct spawnact){ SPAWN_OPEN, rcmd->fd, rcmd->mode, rcmd->file };
+    }
+    ecmd = (struct execcmd*)stage;
+    if(spawn(ecmd->argv[0], ecmd->argv, act, a - act) < 0)
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    else
+      n++;
+    if(in >= 0)
+      close(in);
+    if(last)
+      break;
+    close(p[1]);
+    in = p[0];
+  }
+  return n;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,7 +217,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +237,16 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if((n = spawncmd(cmd)) < 0){
+      if(fork1() == 0)
+        runcmd(cmd);
+      n = 1;
+    }
+    while(n-- > 0)
+      wait(0);
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -261,6 +340,16 @@ backcmd(struct cmd *subcmd)
 // Parsing
 
 char whitespace[] = " \t\r\n\v";
+char *parseerr;  // first syntax error in the command, if any
+
+// Note a syntax error. The shell parses in the parent now,
+// so errors mustn't exit.
+void
+syntax(char *s)
+{
+  if(parseerr == 0)
+    parseerr = s;
+}
 char symbols[] = "<|>&;()";
 
 int
@@ -336,7 +425,13 @@ parsecmd(char *s)
   peek(&s, es, "");
   if(s != es){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    fprintf(2, "%s\n", parseerr);
+    parseerr = 0;
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -380,8 +475,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,8 +503,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -432,13 +531,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -492,3 +595,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a command tree that parsecmd() built.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -7,23 +7,39 @@
 //    for (i = 0; i < 40000; i++)
 //      asm volatile("");
 
+// Each process also creates, writes and unlinks NSMALL small
+// files, which group commit makes cheap, and the first reports
+// how long it all took and how many FS system calls each log
+// commit carried.
+
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memstat.h"
+
+#define NPROC 5
+#define NSMALL 50
+#define TIMEBASE 10000000  // rdtime ticks per second on qemu's virt machine
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, j;
   char path[] = "stressfs0";
+  char small[] = "sf000";
   char data[512];
+  struct memstat ms0, ms1;
+  uint64 t0, t;
 
   printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
+  memstat(&ms0, 0, 0);
+  t0 = r_time();
 
-  for(i = 0; i < 4; i++)
+  for(i = 0; i < NPROC-1; i++)
     if(fork() > 0)
       break;
 
@@ -31,19 +47,39 @@ main(int argc, char *argv[])
 
   path[8] += i;
   fd = open(path, O_CREATE | O_RDWR);
-  for(i = 0; i < 20; i++)
-//    printf(fd, "%d\n", i);
+  for(j = 0; j < 20; j++)
+//    printf(fd, "%d\n", j);
     write(fd, data, sizeof(data));
+  fsync(fd);
   close(fd);
 
+  small[2] += i;
+  for(j = 0; j < NSMALL; j++){
+    small[3] = '0' + j / 10;
+    small[4] = '0' + j % 10;
+    fd = open(small, O_CREATE | O_RDWR);
+    write(fd, data, sizeof(data));
+    close(fd);
+    unlink(small);
+  }
+
   printf("read\n");
 
   fd = open(path, O_RDONLY);
-  for (i = 0; i < 20; i++)
+  for (j = 0; j < 20; j++)
     read(fd, data, sizeof(data));
   close(fd);
 
   wait(0);
 
+  if(i == 0){
+    t = r_time() - t0;
+    memstat(&ms1, 0, 0);
+    printf("stressfs: %d small files in %l us, %l files/s\n", NPROC*NSMALL,
+           t / (TIMEBASE / 1000000), t ? (uint64)NPROC*NSMALL*TIMEBASE / t : 0);
+    printf("stressfs: %l FS calls in %l commits\n", ms1.logops - ms0.logops,
+           ms1.logcommits - ms0.logcommits);
+  }
+
   exit(0);
 }
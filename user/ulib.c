@@ -1,6 +1,9 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
 #include "user/user.h"
 
 //
@@ -145,3 +148,19 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// push cached disk blocks out of the buffer cache, for
+// programs that time or count disk reads: ask for as much
+// memory as is free and as the cache holds, which kalloc()
+// can only find by shrinking the cache, then give it back.
+void
+dropcache(void)
+{
+  struct memstat ms;
+  int n;
+
+  memstat(&ms, 0, 0);
+  n = (ms.free + ms.bufs / (PGSIZE / BSIZE)) * PGSIZE;
+  if(sbrk(n) != (char*)-1)
+    sbrk(-n);
+}
@@ -2,9 +2,34 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks, up to NSMALL units of sizeof(Header) bytes
+// including the header, live on one free list per size:
+// malloc() pops the first block and free() pushes it back,
+// with no search and no coalescing. When a list is empty,
+// a block is carved off the current slab, a run of SLAB
+// units taken from the large allocator.
+//
+// Larger blocks use the allocator by Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7: a free
+// list in address order, first fit, each freed block merged
+// with its neighbours. Since small blocks never go on it,
+// the list stays short.
+//
+// Free blocks of TRIM units or more go back to the kernel:
+// at the top of the heap by shrinking it with sbrk(), keeping
+// KEEP units for the next malloc(), elsewhere by madvise() on
+// the whole pages of the block that the free() just freed;
+// the rest went back when it was freed.
+
+#define NSMALL 64     // 1KB
+#define SLAB   1024   // 16KB
+#define TRIM   8192   // 128KB
+#define KEEP   4096   // 64KB
 
 typedef long Align;
 
@@ -20,13 +45,17 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+static Header *bin[NSMALL+1];  // free small blocks, by size
+static Header *slab;           // next unit to carve
+static uint slableft;          // units left in the slab
 
-void
-free(void *ap)
+// Put large block bp on the free list. Returns the free
+// block that now holds it, after merging.
+static Header*
+lfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -38,9 +67,39 @@ free(void *ap)
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
+    bp = p;
   } else
     p->s.ptr = bp;
   freep = p;
+  return bp;
+}
+
+// Return the memory of free block bp to the kernel, if it
+// is big enough to be worth it: the pages from f to fend,
+// which were just freed and merged into bp.
+static void
+release(Header *bp, char *f, char *fend)
+{
+  char *lo, *hi;
+  uint n;
+
+  if(bp->s.size < TRIM)
+    return;
+  if((char*)(bp + bp->s.size) == sbrk(0)){
+    n = bp->s.size - KEEP;
+    if(sbrk(-(int)(n * sizeof(Header))) != (char*)-1)
+      bp->s.size -= n;
+    return;
+  }
+  // the pages f and fend are in may be wholly free now.
+  lo = (char*)PGROUNDDOWN((uint64)f);
+  if(lo < (char*)(bp + 1))
+    lo = (char*)PGROUNDUP((uint64)(bp + 1));
+  hi = (char*)PGROUNDUP((uint64)fend);
+  if(hi > (char*)(bp + bp->s.size))
+    hi = (char*)PGROUNDDOWN((uint64)(bp + bp->s.size));
+  if(lo < hi)
+    madvise(lo, hi - lo, MADV_DONTNEED);
 }
 
 static Header*
@@ -56,17 +115,16 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// Take a block of nunits from the free list, first fit.
+static Header*
+lalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +139,71 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// Cut a small block of nunits off the slab, starting a new
+// slab if this one is used up.
+static Header*
+carve(uint nunits)
+{
+  Header *p;
+
+  if(slableft < nunits){
+    // the end of the old slab becomes a block of its own size.
+    if(slableft > 0){
+      slab->s.size = slableft;
+      slab->s.ptr = bin[slableft];
+      bin[slableft] = slab;
+    }
+    if((slab = lalloc(SLAB)) == 0){
+      slableft = 0;
+      return 0;
+    }
+    slableft = SLAB;
+  }
+  p = slab;
+  p->s.size = nunits;
+  slab += nunits;
+  slableft -= nunits;
+  return p;
+}
+
+void
+free(void *ap)
+{
+  Header *bp, *end;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size <= NSMALL){
+    bp->s.ptr = bin[bp->s.size];
+    bin[bp->s.size] = bp;
+  } else {
+    end = bp + bp->s.size;
+    release(lfree(bp), (char*)bp, (char*)end);
+  }
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits <= NSMALL){
+    if((p = bin[nunits]) != 0)
+      bin[nunits] = p->s.ptr;
+    else if((p = carve(nunits)) == 0 && (p = lalloc(nunits)) == 0)
+      return 0;
+  } else if((p = lalloc(nunits)) == 0)
+    return 0;
+  return (void*)(p + 1);
+}
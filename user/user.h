@@ -1,4 +1,7 @@
 struct stat;
+struct memstat;
+struct procmem;
+struct spawnact;
 
 // system calls
 int fork(void);
@@ -28,6 +31,14 @@ int peterson_create(void);
 int peterson_acquire(int, int);
 int peterson_release(int, int);
 int peterson_destroy(int);
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int memstat(struct memstat*, struct procmem*, int);
+int spawn(const char*, char**, struct spawnact*, int);
+int madvise(void*, uint64, int);
+int lseek(int, int, int);
+int splice(int, int, int);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -45,6 +56,7 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void dropcache(void);
 
 /* Added for Task 2 - Tournament Lock API */
 
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "kernel/spawn.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -575,9 +577,12 @@ writetest(char *s)
   }
 }
 
+// a file that reaches past the singly-indirect blocks, into
+// two of the index blocks under the doubly-indirect one.
 void
 writebig(char *s)
 {
+  enum { NBIG = NDIRECT + NINDIRECT + NINDIRECT + 1 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -586,7 +591,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +611,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -629,6 +634,74 @@ writebig(char *s)
   }
 }
 
+// two I_EXTENT files written a block at a time in turn, so
+// that each needs more extents than its inode holds.
+void
+extentfiles(char *s)
+{
+  enum { N = 300 };
+  char *names[] = { "ext0", "ext1" };
+  int fds[2], i, k, n;
+
+  for(k = 0; k < 2; k++){
+    unlink(names[k]);
+    fds[k] = open(names[k], O_CREATE|O_RDWR|O_EXTENT);
+    if(fds[k] < 0){
+      printf("%s: create %s failed\n", s, names[k]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    for(k = 0; k < 2; k++){
+      memset(buf, 0, BSIZE);
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = k;
+      if(write(fds[k], buf, BSIZE) != BSIZE){
+        printf("%s: write %s block %d failed\n", s, names[k], i);
+        exit(1);
+      }
+    }
+  }
+  for(k = 0; k < 2; k++)
+    close(fds[k]);
+
+  for(k = 0; k < 2; k++){
+    fds[k] = open(names[k], O_RDONLY);
+    for(i = 0; (n = read(fds[k], buf, BSIZE)) == BSIZE; i++){
+      if(((int*)buf)[0] != i || ((int*)buf)[1] != k){
+        printf("%s: %s block %d holds %d of %d\n", s, names[k], i,
+               ((int*)buf)[0], ((int*)buf)[1]);
+        exit(1);
+      }
+    }
+    close(fds[k]);
+    if(n != 0 || i != N){
+      printf("%s: read %d blocks of %s\n", s, i, names[k]);
+      exit(1);
+    }
+  }
+
+  // truncated, it keeps the layout and can grow again.
+  fds[0] = open(names[0], O_RDWR|O_TRUNC);
+  if(fds[0] < 0 || write(fds[0], "abc", 3) != 3){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  fds[0] = open(names[0], O_RDONLY);
+  if(read(fds[0], buf, BSIZE) != 3 || memcmp(buf, "abc", 3) != 0){
+    printf("%s: reread failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  for(k = 0; k < 2; k++){
+    if(unlink(names[k]) < 0){
+      printf("%s: unlink %s failed\n", s, names[k]);
+      exit(1);
+    }
+  }
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -730,6 +803,238 @@ exectest(char *s)
 
 }
 
+// a running program pages its text in from its file, so
+// the file can't be opened for writing or truncated until
+// the program is gone.
+void
+textbusy(char *s)
+{
+  char *argv[] = { "tbcat", 0 };
+  int in[2], out[2], fd, src, n, pid, xstatus;
+  char c;
+
+  // run a copy of cat, so a broken check can't spoil cat.
+  src = open("cat", O_RDONLY);
+  fd = open("tbcat", O_CREATE|O_TRUNC|O_WRONLY);
+  if(src < 0 || fd < 0){
+    printf("%s: copy cat failed\n", s);
+    exit(1);
+  }
+  while((n = read(src, buf, sizeof(buf))) > 0){
+    if(write(fd, buf, n) != n){
+      printf("%s: copy cat failed\n", s);
+      exit(1);
+    }
+  }
+  close(src);
+  close(fd);
+
+  if(pipe(in) < 0 || pipe(out) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    exec("tbcat", argv);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+  // once cat echoes a byte, it's running.
+  if(write(in[1], "x", 1) != 1 || read(out[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: tbcat didn't run\n", s);
+    exit(1);
+  }
+
+  if((fd = open("tbcat", O_WRONLY)) >= 0 || (fd = open("tbcat", O_RDWR)) >= 0 ||
+     (fd = open("tbcat", O_RDONLY|O_TRUNC)) >= 0){
+    printf("%s: opened a running program to write\n", s);
+    exit(1);
+  }
+  if((fd = open("tbcat", O_RDONLY)) < 0){
+    printf("%s: can't read a running program\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  close(in[1]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: tbcat failed\n", s);
+    exit(1);
+  }
+  close(out[0]);
+  if((fd = open("tbcat", O_WRONLY|O_TRUNC)) < 0){
+    printf("%s: can't write the program once it's gone\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("tbcat");
+}
+
+// one big write into a pipe, read back in odd-sized pieces,
+// so that the pipe's buffer grows and wraps around while
+// both sides are busy.
+void
+bigpipe(char *s)
+{
+  enum { N = 100*1024, R = 1237 };
+  static char buf[N];
+  int fds[2], pid, n, total, xstatus;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int i = 0; i < N; i++)
+      buf[i] = i % 251;
+    if(write(fds[1], buf, N) != N)
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf + total, total + R < N ? R : N - total)) > 0){
+    for(int i = total; i < total + n; i++){
+      if(buf[i] != (char)(i % 251)){
+        printf("%s: byte %d is wrong\n", s, i);
+        exit(1);
+      }
+    }
+    total += n;
+    if(total == N)
+      break;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(total != N || xstatus != 0){
+    printf("%s: read %d of %d bytes\n", s, total, N);
+    exit(1);
+  }
+}
+
+// splice() a file into a pipe, read by a child into whole
+// pages, then splice() what a child writes into a pipe out
+// to a file.
+void
+splicetest(char *s)
+{
+  enum { N = 3*PGSIZE + 100 };
+  static char buf[N];
+  int fd, fds[2], pid, n, total, xstatus;
+  char *a;
+
+  for(int i = 0; i < N; i++)
+    buf[i] = i % 253;
+  unlink("splicefile");
+  fd = open("splicefile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // file to pipe to whole pages.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    a = sbrk(2*PGSIZE + N);
+    a = (char*)PGROUNDUP((uint64)a);
+    memset(a, 0, N);
+    total = 0;
+    while(total < N && (n = read(fds[0], a + total, N - total)) > 0)
+      total += n;
+    if(total != N || memcmp(a, buf, N) != 0)
+      exit(1);
+    exit(0);
+  }
+  close(fds[0]);
+  fd = open("splicefile", O_RDONLY);
+  total = 0;
+  while((n = splice(fd, fds[1], N)) > 0)
+    total += n;
+  close(fd);
+  close(fds[1]);
+  wait(&xstatus);
+  if(n < 0 || total != N || xstatus != 0){
+    printf("%s: splice from a file moved %d of %d bytes\n", s, total, N);
+    exit(1);
+  }
+
+  // pipe to file.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if(write(fds[1], buf, N) != N)
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  fd = open("splicefile", O_RDWR|O_TRUNC);
+  total = 0;
+  while((n = splice(fds[0], fd, N)) > 0)
+    total += n;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(total != N || xstatus != 0){
+    printf("%s: splice to a file moved %d of %d bytes\n", s, total, N);
+    exit(1);
+  }
+  fd = open("splicefile", O_RDONLY);
+  memset(buf, 0, N);
+  if(read(fd, buf, N) != N){
+    printf("%s: short file\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(int i = 0; i < N; i++){
+    if(buf[i] != (char)(i % 253)){
+      printf("%s: byte %d is wrong\n", s, i);
+      exit(1);
+    }
+  }
+  if(splice(0, 1, 1) != -1){
+    printf("%s: splice of the wrong kinds of file succeeded\n", s);
+    exit(1);
+  }
+  unlink("splicefile");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1086,8 +1391,208 @@ mem(char *s)
   }
 }
 
+// malloc blocks of many sizes, small and large, fill each
+// with its own byte, free every other one, allocate again,
+// and check that no block was handed out twice.
+void
+mallocsizes(char *s)
+{
+  enum { N = 300 };
+  char *a[N];
+  uint n[N];
+
+  for(int round = 0; round < 2; round++){
+    for(int i = 0; i < N; i++){
+      if(round == 1 && (i & 1))
+        continue;
+      n[i] = (i * 37) % 2000 + (i % 10 == 0 ? 20000 : 0);
+      if((a[i] = malloc(n[i])) == 0){
+        printf("%s: malloc(%d) failed\n", s, n[i]);
+        exit(1);
+      }
+      memset(a[i], i, n[i]);
+    }
+    for(int i = 0; i < N; i++){
+      for(uint j = 0; j < n[i]; j++){
+        if(a[i][j] != (char)i){
+          printf("%s: block %d of %d bytes overwritten\n", s, i, n[i]);
+          exit(1);
+        }
+      }
+    }
+    for(int i = 0; i < N; i += 2)
+      free(a[i]);
+  }
+  for(int i = 1; i < N; i += 2)
+    free(a[i]);
+}
+
+// freeing a big malloc() block gives the memory back.
+void
+malloctrim(char *s)
+{
+  enum { SZ = 1024*1024 };
+  char *brk0, *brk1, *a, *b;
+
+  free(malloc(1));
+  brk0 = sbrk(0);
+  a = malloc(SZ);
+  b = malloc(SZ);
+  if(a == 0 || b == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  memset(a, 1, SZ);
+  memset(b, 2, SZ);
+  free(b);
+  free(a);
+  brk1 = sbrk(0);
+  if(brk1 - brk0 > SZ/4){
+    printf("%s: heap still %d bytes bigger\n", s, (int)(brk1 - brk0));
+    exit(1);
+  }
+}
+
 // More file system tests
 
+// a big write() should take a few big transactions,
+// not one per few KB, which log the bitmap block once
+// each, not once per block allocated.
+void
+bigtxn(char *s)
+{
+  enum { SZ = 128*1024 };
+  struct memstat ms0, ms1;
+  char *buf;
+  int fd, i;
+
+  if((buf = malloc(SZ)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  fd = open("bigtxn", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memstat(&ms0, 0, 0);
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  memstat(&ms1, 0, 0);
+  close(fd);
+  if(ms1.logops - ms0.logops > 8){
+    printf("%s: %dKB write took %l transactions\n", s, SZ / 1024,
+           ms1.logops - ms0.logops);
+    exit(1);
+  }
+  if(ms1.logabsorbs - ms0.logabsorbs < SZ / BSIZE / 2){
+    printf("%s: only %l of %l log writes absorbed\n", s,
+           ms1.logabsorbs - ms0.logabsorbs, ms1.logwrites - ms0.logwrites);
+    exit(1);
+  }
+  memset(buf, 0, SZ);
+  fd = open("bigtxn", O_RDONLY);
+  if(fd < 0 || read(fd, buf, SZ) != SZ){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("bigtxn");
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  free(buf);
+}
+
+// fsync() returns once earlier FS system calls are on disk;
+// a run of them that don't wait for each other share commits.
+void
+fsynctest(char *s)
+{
+  enum { N = 20 };
+  struct memstat ms0, ms1;
+  char name[4];
+  int fd;
+
+  if(fsync(-1) != -1 || fsync(NOFILE) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+  memstat(&ms0, 0, 0);
+  name[0] = 'f';
+  name[3] = 0;
+  for(int i = 0; i < N; i++){
+    name[1] = '0' + i / 10;
+    name[2] = '0' + i % 10;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0 || write(fd, "x", 1) != 1){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    if(i == N-1 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  memstat(&ms1, 0, 0);
+  for(int i = 0; i < N; i++){
+    name[1] = '0' + i / 10;
+    name[2] = '0' + i % 10;
+    unlink(name);
+  }
+  if(ms1.logcommits == ms0.logcommits ||
+     ms1.logcommits - ms0.logcommits >= ms1.logops - ms0.logops){
+    printf("%s: %l FS calls in %l commits\n", s, ms1.logops - ms0.logops,
+           ms1.logcommits - ms0.logcommits);
+    exit(1);
+  }
+}
+
+// lseek() to the start, middle and end of a file.
+void
+lseektest(char *s)
+{
+  int fd;
+  char c;
+
+  unlink("lseekfile");
+  fd = open("lseekfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "abcdef", 6) != 6){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 2, SEEK_SET) != 2 || read(fd, &c, 1) != 1 || c != 'c'){
+    printf("%s: SEEK_SET failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 1, SEEK_CUR) != 4 || read(fd, &c, 1) != 1 || c != 'e'){
+    printf("%s: SEEK_CUR failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -6, SEEK_END) != 0 || read(fd, &c, 1) != 1 || c != 'a'){
+    printf("%s: SEEK_END failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -1, SEEK_SET) != -1 || lseek(fd, 0, 7) != -1){
+    printf("%s: bad lseek succeeded\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 10, SEEK_SET) != 10 || read(fd, &c, 1) != 0){
+    printf("%s: read past the end\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lseekfile");
+}
+
 // two processes write to the same file descriptor
 // is the offset shared? does inode locking work?
 void
@@ -2554,7 +3059,401 @@ sbrk8000(char *s)
   *(top-1) = *(top-1) + 1;
 }
 
+// with megapages (make NHUGEPG=n), a heap that spans 2MB
+// boundaries gets them; fork() must copy them, shrinking into
+// one must split it and keep the rest, and all of them must
+// go back to the pool.
+void
+megapages(char *s)
+{
+  struct memstat ms0, ms1;
+  char *base, *mid, *top, *p;
+  int pid, xstatus;
+
+  memstat(&ms0, 0, 0);
+  if(ms0.megafree < 2)
+    return;
+  base = sbrk(0);
+  top = (char*)MEGAPGROUNDUP((uint64)base) + 2*MEGAPGSIZE;
+  if(sbrk(top - base) != base){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  memstat(&ms1, 0, 0);
+  if(ms0.megafree - ms1.megafree < 2){
+    printf("%s: %dMB heap took %l megapages\n", s,
+           (int)((top - base) >> 20), ms0.megafree - ms1.megafree);
+    exit(1);
+  }
+  for(p = base; p < top; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = base; p < top; p += PGSIZE){
+      if(*(uint64*)p != (uint64)p){
+        printf("%s: child sees wrong data at %p\n", s, p);
+        exit(1);
+      }
+      *(uint64*)p = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = base; p < top; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: child's write showed up in parent at %p\n", s, p);
+      exit(1);
+    }
+  }
+
+  // end the heap part way into the last megapage.
+  mid = top - MEGAPGSIZE/2 - PGSIZE/2;
+  if(sbrk(mid - top) != top){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(p = base; p < mid; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: wrong data at %p after split\n", s, p);
+      exit(1);
+    }
+    *(uint64*)p = ~(uint64)p;
+  }
+
+  if(sbrk(base - mid) != mid){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  memstat(&ms1, 0, 0);
+  if(ms1.megafree != ms0.megafree){
+    printf("%s: %l megapages free, %l before\n", s,
+           ms1.megafree, ms0.megafree);
+    exit(1);
+  }
+}
+
+
+// mmap() of a file: read through a private mapping, write
+// back through a shared one, munmap() of part of a region,
+// read() into a page not yet touched, and fork().
+void
+mmaptest(char *s)
+{
+  enum { SZ = 3*PGSIZE };
+  char *p, *q;
+  int fd, i, pid, xstatus;
+
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = "abc"[i % 3];
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(p[i] != "abc"[i % 3]){
+      printf("%s: wrong byte %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // a child gets a copy of the touched pages.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exit(p[PGSIZE] == "abc"[PGSIZE % 3] ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+
+  p[0] = 'Z';
+  p[SZ-1] = 'Y';
+  if(munmap(p + PGSIZE, PGSIZE) < 0 || munmap(p, PGSIZE) < 0 ||
+     munmap(p + 2*PGSIZE, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // the writes must have reached the file.
+  q = mmap(0, SZ, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(q == (char*)-1){
+    printf("%s: second mmap failed\n", s);
+    exit(1);
+  }
+  if(q[0] != 'Z' || q[SZ-1] != 'Y'){
+    printf("%s: shared write not written back\n", s);
+    exit(1);
+  }
+
+  // a read-only mapping can't be the destination of read().
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, q, 1) >= 0){
+    printf("%s: read into read-only mapping succeeded\n", s);
+    exit(1);
+  }
+  munmap(q, SZ);
+
+  // read() into an anonymous page that hasn't been touched.
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(q == (char*)-1){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  if(read(fd, q, 3) != 3 || q[0] != 'Z' || q[1] != 'b'){
+    printf("%s: read into anonymous mapping failed\n", s);
+    exit(1);
+  }
+  munmap(q, PGSIZE);
+  close(fd);
+  unlink("mmapfile");
+}
+
+// memstat()'s free count and this process's resident size
+// should both move by the pages that sbrk() adds.
+struct procmem pm[NPROC];
 
+uint64
+myrss(char *s, struct memstat *ms)
+{
+  int n = memstat(ms, pm, NPROC);
+
+  for(int i = 0; i < n; i++)
+    if(pm[i].pid == getpid())
+      return pm[i].rss;
+  printf("%s: no memstat entry for self\n", s);
+  exit(1);
+}
+
+void
+memstattest(char *s)
+{
+  enum { N = 64 };
+  struct memstat ms0, ms1;
+  uint64 rss0, rss1;
+
+  rss0 = myrss(s, &ms0);
+  if(ms0.free == 0 || ms0.free > ms0.total){
+    printf("%s: free %l of %l\n", s, ms0.free, ms0.total);
+    exit(1);
+  }
+  if(sbrk(N*PGSIZE) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  rss1 = myrss(s, &ms1);
+  if(rss1 != rss0 + N){
+    printf("%s: rss %l, then %l after sbrk of %d pages\n", s, rss0, rss1, N);
+    exit(1);
+  }
+  if(ms0.free - ms1.free < N){
+    printf("%s: free %l, then %l after sbrk of %d pages\n", s, ms0.free, ms1.free, N);
+    exit(1);
+  }
+}
+
+// the buffer cache grows past NBUF to hold a file read
+// twice, so the second read finds its blocks cached.
+void
+bcachegrow(char *s)
+{
+  enum { N = 100 };
+  static char buf[N*BSIZE];
+  struct memstat ms0, ms1;
+  int fd;
+
+  memstat(&ms0, 0, 0);
+  if(ms0.bufmax < 2*N)
+    return;
+  unlink("bcachefile");
+  fd = open("bcachefile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(int i = 0; i < 2; i++){
+    memstat(&ms0, 0, 0);
+    fd = open("bcachefile", O_RDONLY);
+    if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    memstat(&ms1, 0, 0);
+  }
+  unlink("bcachefile");
+  if(ms1.bufs <= NBUF || ms1.bufmisses - ms0.bufmisses > N/10){
+    printf("%s: %l bufs, %l misses reading the file again\n", s,
+           ms1.bufs, ms1.bufmisses - ms0.bufmisses);
+    exit(1);
+  }
+}
+
+// check that the n bytes at buf came from offset off of a
+// file whose block i is full of byte i.
+int
+rablocks(char *buf, int off, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(buf[i] != (char)((off + i) / BSIZE))
+      return 0;
+  return 1;
+}
+
+// read back a file that isn't cached, in pieces that don't
+// line up with blocks, sequentially and then at scattered
+// offsets, so that reads find blocks read ahead both in
+// flight and done, and the disk has several requests at once,
+// each for a run of blocks.
+void
+readahead(char *s)
+{
+  enum { N = 120, CHUNK = 700 };
+  static char buf[BSIZE];
+  struct memstat ms0, ms1;
+  int fd, n, off;
+
+  unlink("rafile");
+  fd = open("rafile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  dropcache();
+  memstat(&ms0, 0, 0);
+  fd = open("rafile", O_RDONLY);
+  for(off = 0; (n = read(fd, buf, CHUNK)) > 0; off += n){
+    if(!rablocks(buf, off, n)){
+      printf("%s: wrong data at %d\n", s, off);
+      exit(1);
+    }
+  }
+  close(fd);
+  memstat(&ms1, 0, 0);
+  // some request should have found another in flight.
+  if(off != N*BSIZE || ms1.bufaheads == ms0.bufaheads ||
+     ms1.diskdepthsum - ms0.diskdepthsum <= ms1.diskreqs - ms0.diskreqs ||
+     ms1.diskreqs - ms0.diskreqs > N/2){
+    printf("%s: read %d bytes, %l blocks read ahead, %l requests, depth sum %l\n",
+           s, off, ms1.bufaheads - ms0.bufaheads, ms1.diskreqs - ms0.diskreqs,
+           ms1.diskdepthsum - ms0.diskdepthsum);
+    exit(1);
+  }
+
+  dropcache();
+  fd = open("rafile", O_RDONLY);
+  for(int i = 0; i < N; i++){
+    off = (i * 37 % N) * BSIZE + i;
+    if(lseek(fd, off, SEEK_SET) != off ||
+       (n = read(fd, buf, CHUNK)) != CHUNK || !rablocks(buf, off, n)){
+      printf("%s: wrong data at %d\n", s, off);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("rafile");
+}
+
+// madvise(MADV_DONTNEED) frees heap pages, which read back
+// as zeros; a MAP_SHARED region can't be discarded.
+void
+madvisetest(char *s)
+{
+  enum { N = 16 };
+  struct memstat ms;
+  uint64 rss0, rss1;
+  char *a, *m;
+  int pid, xstatus;
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)PGROUNDUP((uint64)a);
+  for(int i = 0; i < N-1; i++)
+    a[i*PGSIZE] = 'x';
+  rss0 = myrss(s, &ms);
+  if(madvise(a, (N-1)*PGSIZE, MADV_DONTNEED) != 0){
+    printf("%s: madvise failed\n", s);
+    exit(1);
+  }
+  rss1 = myrss(s, &ms);
+  if(rss1 + N-1 > rss0){
+    printf("%s: rss %l after madvise, %l before\n", s, rss1, rss0);
+    exit(1);
+  }
+
+  // a child sees the discarded pages as zeros too.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < N-1; i++)
+      if(a[i*PGSIZE] != 0)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw old contents\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N-1; i++){
+    if(a[i*PGSIZE] != 0){
+      printf("%s: page %d not zero\n", s, i);
+      exit(1);
+    }
+    a[i*PGSIZE] = 'y';
+  }
+
+  m = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(m == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(madvise(m, PGSIZE, MADV_DONTNEED) != -1){
+    printf("%s: madvise of a shared region succeeded\n", s);
+    exit(1);
+  }
+  munmap(m, PGSIZE);
+}
 
 // regression test. test whether exec() leaks memory if one of the
 // arguments is invalid. the test passes if the kernel doesn't panic.
@@ -2571,6 +3470,48 @@ badarg(char *s)
   exit(0);
 }
 
+// spawn() echo with its output redirected to a file, then
+// a program that doesn't exist, which should fail without
+// leaving a child behind.
+void
+spawntest(char *s)
+{
+  char *args[] = { "echo", "spawned", 0 };
+  char *bad[] = { "nosuchprogram", 0 };
+  struct spawnact act[] = {
+    { SPAWN_OPEN, 1, O_WRONLY|O_CREATE|O_TRUNC, "spawnout" },
+  };
+  char out[16];
+  int pid, xstatus, fd, n;
+
+  pid = spawn("echo", args, act, 1);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: echo didn't exit cleanly\n", s);
+    exit(1);
+  }
+  fd = open("spawnout", O_RDONLY);
+  n = read(fd, out, sizeof(out));
+  close(fd);
+  unlink("spawnout");
+  if(n != 8 || memcmp(out, "spawned\n", 8) != 0){
+    printf("%s: wrong output from spawned echo\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", bad, 0, 0) >= 0){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2590,10 +3531,14 @@ struct test {
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
+  {extentfiles, "extentfiles"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {textbusy, "textbusy"},
   {pipe1, "pipe1"},
+  {bigpipe, "bigpipe"},
+  {splicetest, "splice"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2603,6 +3548,11 @@ struct test {
   {forkforkfork, "forkforkfork"},
   {reparent2, "reparent2"},
   {mem, "mem"},
+  {lseektest, "lseek"},
+  {fsynctest, "fsync"},
+  {bigtxn, "bigtxn"},
+  {mallocsizes, "mallocsizes"},
+  {malloctrim, "malloctrim"},
   {sharedfd, "sharedfd"},
   {fourfiles, "fourfiles"},
   {createdelete, "createdelete"},
@@ -2634,7 +3584,14 @@ struct test {
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {megapages, "megapages"},
   {badarg, "badarg" },
+  {mmaptest, "mmap" },
+  {memstattest, "memstat" },
+  {madvisetest, "madvise" },
+  {bcachegrow, "bcachegrow" },
+  {readahead, "readahead" },
+  {spawntest, "spawn" },
 
   { 0, 0},
 };
@@ -2924,6 +3881,77 @@ outofinodes(char *s)
   }
 }
 
+// fill memory with the pages of a sleeping child, then
+// allocate more than is left, so that some of the child's
+// pages go out to swap. the child should find them intact
+// when it wakes up.
+void
+swaptest(char *s)
+{
+  struct memstat ms0, ms1;
+  int go[2], ready[2], pid, xstatus;
+  uint64 n, m, i;
+  char c, *a;
+
+  memstat(&ms0, 0, 0);
+  if(ms0.swaptotal == 0 || ms0.free < 1024)
+    return;
+  n = ms0.free - 256;
+  m = 256 + ms0.swaptotal / 4;
+
+  if(pipe(go) < 0 || pipe(ready) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((a = sbrk(n*PGSIZE)) == (char*)-1){
+      printf("%s: child sbrk failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < n; i++)
+      a[i*PGSIZE] = i;
+    write(ready[1], "x", 1);
+    read(go[0], &c, 1);
+    for(i = 0; i < n; i++){
+      if(a[i*PGSIZE] != (char)i){
+        printf("%s: page %l lost in swap\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  if(read(ready[0], &c, 1) != 1){
+    printf("%s: child didn't get its memory\n", s);
+    wait(0);
+    exit(1);
+  }
+  if((a = sbrk(m*PGSIZE)) == (char*)-1){
+    printf("%s: sbrk of %l pages failed with swap\n", s, m);
+    kill(pid);
+    wait(0);
+    exit(1);
+  }
+  for(i = 0; i < m; i++)
+    a[i*PGSIZE] = 1;
+  sbrk(-m*PGSIZE);
+
+  write(go[1], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  memstat(&ms1, 0, 0);
+  if(ms1.swapouts == ms0.swapouts || ms1.swapins == ms0.swapins){
+    printf("%s: nothing went through swap\n", s);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3959,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swaptest, "swap"},
     
   { 0, 0},
 };
@@ -41,4 +41,12 @@ entry("uptime");
 entry("peterson_create");
 entry("peterson_acquire");
 entry("peterson_release");
-entry("peterson_destroy");
\ No newline at end of file
+entry("peterson_destroy");
+entry("mmap");
+entry("munmap");
+entry("memstat");
+entry("spawn");
+entry("madvise");
+entry("lseek");
+entry("splice");
+entry("fsync");